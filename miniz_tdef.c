@@ -738,11 +738,59 @@ static MZ_FORCEINLINE mz_uint32 TDEFL_READ_UNALIGNED_DWORD(const void* p)
     return *(const mz_uint32 *)p;
 }
 
+// pkg2zip: match length is found with wide compares and count of trailing zeros instead of 16-bit compare loop
+// result is same as original loop, so output does not change
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TDEFL_MATCH_SSE2 1
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+static MZ_FORCEINLINE mz_uint tdefl_ctz32(mz_uint32 x)
+{
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return (mz_uint)index;
+}
+#else
+#define tdefl_ctz32(x) ((mz_uint)__builtin_ctz(x))
+#endif
+
+// returns length of common prefix of p and q, at most TDEFL_MAX_MATCH_LEN bytes
+// both p and q must have TDEFL_MAX_MATCH_LEN bytes readable
+static MZ_FORCEINLINE mz_uint tdefl_match_len(const mz_uint8 *p, const mz_uint8 *q)
+{
+    mz_uint len;
+#if defined(TDEFL_MATCH_SSE2)
+    for (len = 0; len < 256; len += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(p + len));
+        __m128i b = _mm_loadu_si128((const __m128i *)(q + len));
+        mz_uint32 mask = (mz_uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xFFFF;
+        if (mask)
+            return len + tdefl_ctz32(mask);
+    }
+#else
+    for (len = 0; len < 256; len += 4)
+    {
+        mz_uint32 diff = TDEFL_READ_UNALIGNED_DWORD(p + len) ^ TDEFL_READ_UNALIGNED_DWORD(q + len);
+        if (diff)
+            return len + (tdefl_ctz32(diff) >> 3);
+    }
+#endif
+    if (p[256] != q[256])
+        return 256;
+    if (p[257] != q[257])
+        return 257;
+    return TDEFL_MAX_MATCH_LEN;
+}
+
 static MZ_FORCEINLINE void tdefl_find_match(tdefl_compressor *d, mz_uint lookahead_pos, mz_uint max_dist, mz_uint max_match_len, mz_uint *pMatch_dist, mz_uint *pMatch_len)
 {
     mz_uint dist, pos = lookahead_pos & TDEFL_LZ_DICT_SIZE_MASK, match_len = *pMatch_len, probe_pos = pos, next_probe_pos, probe_len;
     mz_uint num_probes_left = d->m_max_probes[match_len >= 32];
-    const mz_uint16 *s = (const mz_uint16 *)(d->m_dict + pos), *p, *q;
+    const mz_uint16 *s = (const mz_uint16 *)(d->m_dict + pos), *q;
     mz_uint16 c01 = TDEFL_READ_UNALIGNED_WORD(&d->m_dict[pos + match_len - 1]), s01 = TDEFL_READ_UNALIGNED_WORD(s);
     MZ_ASSERT(max_match_len <= TDEFL_MAX_MATCH_LEN);
     if (max_match_len <= match_len)
@@ -769,19 +817,14 @@ static MZ_FORCEINLINE void tdefl_find_match(tdefl_compressor *d, mz_uint lookahe
         q = (const mz_uint16 *)(d->m_dict + probe_pos);
         if (TDEFL_READ_UNALIGNED_WORD(q) != s01)
             continue;
-        p = s;
-        probe_len = 32;
-        do
-        {
-        } while ((TDEFL_READ_UNALIGNED_WORD(++p) == TDEFL_READ_UNALIGNED_WORD(++q)) && (TDEFL_READ_UNALIGNED_WORD(++p) == TDEFL_READ_UNALIGNED_WORD(++q)) &&
-                 (TDEFL_READ_UNALIGNED_WORD(++p) == TDEFL_READ_UNALIGNED_WORD(++q)) && (TDEFL_READ_UNALIGNED_WORD(++p) == TDEFL_READ_UNALIGNED_WORD(++q)) && (--probe_len > 0));
-        if (!probe_len)
+        probe_len = tdefl_match_len((const mz_uint8 *)s, (const mz_uint8 *)q);
+        if (probe_len == TDEFL_MAX_MATCH_LEN)
         {
             *pMatch_dist = dist;
             *pMatch_len = MZ_MIN(max_match_len, (mz_uint)TDEFL_MAX_MATCH_LEN);
             break;
         }
-        else if ((probe_len = ((mz_uint)(p - s) * 2) + (mz_uint)(*(const mz_uint8 *)p == *(const mz_uint8 *)q)) > match_len)
+        else if (probe_len > match_len)
         {
             *pMatch_dist = dist;
             if ((*pMatch_len = match_len = MZ_MIN(max_match_len, probe_len)) == max_match_len)
@@ -878,15 +921,8 @@ static mz_bool tdefl_compress_fast(tdefl_compressor *d)
 
             if (((cur_match_dist = (mz_uint16)(lookahead_pos - probe_pos)) <= dict_size) && ((TDEFL_READ_UNALIGNED_DWORD(d->m_dict + (probe_pos &= TDEFL_LZ_DICT_SIZE_MASK)) & 0xFFFFFF) == first_trigram))
             {
-                const mz_uint16 *p = (const mz_uint16 *)pCur_dict;
-                const mz_uint16 *q = (const mz_uint16 *)(d->m_dict + probe_pos);
-                mz_uint32 probe_len = 32;
-                do
-                {
-                } while ((TDEFL_READ_UNALIGNED_WORD(++p) == TDEFL_READ_UNALIGNED_WORD(++q)) && (TDEFL_READ_UNALIGNED_WORD(++p) == TDEFL_READ_UNALIGNED_WORD(++q)) &&
-                         (TDEFL_READ_UNALIGNED_WORD(++p) == TDEFL_READ_UNALIGNED_WORD(++q)) && (TDEFL_READ_UNALIGNED_WORD(++p) == TDEFL_READ_UNALIGNED_WORD(++q)) && (--probe_len > 0));
-                cur_match_len = ((mz_uint)(p - (const mz_uint16 *)pCur_dict) * 2) + (mz_uint)(*(const mz_uint8 *)p == *(const mz_uint8 *)q);
-                if (!probe_len)
+                cur_match_len = tdefl_match_len(pCur_dict, d->m_dict + probe_pos);
+                if (cur_match_len == TDEFL_MAX_MATCH_LEN)
                     cur_match_len = cur_match_dist ? TDEFL_MAX_MATCH_LEN : 0;
 
                 if ((cur_match_len < TDEFL_MIN_MATCH_LEN) || ((cur_match_len == TDEFL_MIN_MATCH_LEN) && (cur_match_dist >= 8U * 1024U)))
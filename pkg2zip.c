@@ -1,4 +1,5 @@
 #include "pkg2zip_aes.h"
+#include "pkg2zip_http.h"
 #include "pkg2zip_zip.h"
 #include "pkg2zip_out.h"
 #include "pkg2zip_psp.h"
@@ -20,6 +21,9 @@
 #define PKG_HEADER_SIZE 192
 #define PKG_HEADER_EXT_SIZE 64
 
+// local and central directory header with zip64 extra fields and root folder in name, without item name
+#define ZIP_ITEM_OVERHEAD 256
+
 // https://wiki.henkaku.xyz/vita/Packages#AES_Keys
 static const uint8_t pkg_ps3_key[] = { 0x2e, 0x7b, 0x71, 0xd7, 0xc9, 0xc9, 0xa1, 0x4e, 0xa3, 0x22, 0x1f, 0x18, 0x88, 0x28, 0xb8, 0xf8 };
 static const uint8_t pkg_psp_key[] = { 0x07, 0xf2, 0xc6, 0x82, 0x90, 0xb5, 0x0d, 0x2c, 0x33, 0x81, 0x8d, 0x70, 0x9b, 0x60, 0xe6, 0x2b };
@@ -184,58 +188,151 @@ static void parse_sfo(sys_file f, uint64_t sfo_offset, uint32_t sfo_size, char*
     parse_sfo_content(sfo, sfo_size, category, title, content, min_version, pkg_version);
 }
 
-static void find_psp_sfo(const aes128_key* key, const aes128_key* ps3_key, const uint8_t* iv, sys_file pkg, uint64_t pkg_size, uint64_t enc_offset, uint64_t items_offset, uint32_t item_count, char* category, char* title)
+typedef struct {
+    uint64_t data_offset;
+    uint64_t data_size;
+    uint32_t name_offset;
+    uint32_t name_size;
+    uint32_t name; // offset in names
+    uint8_t psp_type;
+    uint8_t flags;
+} pkg_item;
+
+typedef struct {
+    pkg_item* items;
+    uint32_t count;
+    char* names;
+} pkg_index;
+
+// reads whole item table with decrypted names, so items can be processed in any order afterwards
+static void read_items(pkg_index* index, const aes128_key* key, const aes128_key* ps3_key, int psp, const uint8_t* iv, sys_file pkg, uint64_t pkg_size, uint64_t enc_offset, uint64_t items_offset, uint32_t item_count)
 {
-    for (uint32_t item_index = 0; item_index < item_count; item_index++)
+    // item count comes from header, so size is checked before anything is allocated for it
+    uint64_t table_size = (uint64_t)item_count * 32;
+    if (item_count >= UINT32_MAX / sizeof(pkg_item) || pkg_size - enc_offset < items_offset + table_size)
     {
-        uint8_t item[32];
-        uint64_t item_offset = items_offset + item_index * 32;
-        sys_read(pkg, enc_offset + item_offset, item, sizeof(item));
-        aes128_ctr_xor(key, iv, item_offset / 16, item, sizeof(item));
+        sys_error("ERROR: pkg file is too small\n");
+    }
 
-        uint32_t name_offset = get32be(item + 0);
-        uint32_t name_size = get32be(item + 4);
-        uint64_t data_offset = get64be(item + 8);
-        uint64_t data_size = get64be(item + 16);
-        uint8_t psp_type = item[24];
+    uint8_t* table = sys_realloc(NULL, table_size + 1);
+    sys_read(pkg, enc_offset + items_offset, table, (uint32_t)table_size);
+    aes128_ctr_xor(key, iv, items_offset / 16, table, (uint32_t)table_size);
 
-        assert(name_offset % 16 == 0);
-        assert(data_offset % 16 == 0);
+    index->items = sys_realloc(NULL, (item_count + 1) * sizeof(pkg_item));
+    index->count = item_count;
 
-        if (pkg_size < enc_offset + name_offset + name_size ||
-            pkg_size < enc_offset + data_offset + data_size)
+    uint64_t names_size = 0;
+    for (uint32_t item_index = 0; item_index < item_count; item_index++)
+    {
+        const uint8_t* item = table + item_index * 32;
+        pkg_item* it = index->items + item_index;
+
+        it->name_offset = get32be(item + 0);
+        it->name_size = get32be(item + 4);
+        it->data_offset = get64be(item + 8);
+        it->data_size = get64be(item + 16);
+        it->psp_type = item[24];
+        it->flags = item[27];
+        it->name = (uint32_t)names_size;
+
+        assert(it->name_offset % 16 == 0);
+        assert(it->data_offset % 16 == 0);
+
+        if (pkg_size < enc_offset + it->name_offset + it->name_size ||
+            pkg_size < enc_offset + it->data_offset + it->data_size)
         {
             sys_error("ERROR: pkg file is too short, possibly corrupted\n");
         }
 
-        const aes128_key* item_key = psp_type == 0x90 ? key : ps3_key;
+        if (it->name_size >= ZIP_MAX_FILENAME)
+        {
+            sys_error("ERROR: pkg file contains file with very long name\n");
+        }
 
-        char name[ZIP_MAX_FILENAME];
-        sys_read(pkg, enc_offset + name_offset, name, name_size);
-        aes128_ctr_xor(item_key, iv, name_offset / 16, (uint8_t*)name, name_size);
-        name[name_size] = 0;
+        names_size += it->name_size + 1;
+        if (names_size > pkg_size || names_size >= UINT32_MAX)
+        {
+            sys_error("ERROR: pkg file contains too many names, possibly corrupted\n");
+        }
+    }
+
+    index->names = sys_realloc(NULL, names_size + 1);
+    for (uint32_t item_index = 0; item_index < item_count; item_index++)
+    {
+        const pkg_item* it = index->items + item_index;
+        const aes128_key* item_key = psp && it->psp_type != 0x90 ? ps3_key : key;
+
+        char* name = index->names + it->name;
+        sys_read(pkg, enc_offset + it->name_offset, name, it->name_size);
+        aes128_ctr_xor(item_key, iv, it->name_offset / 16, (uint8_t*)name, it->name_size);
+        name[it->name_size] = 0;
+    }
+
+    sys_realloc(table, 0);
+}
+
+static void find_psp_sfo(const pkg_index* index, const aes128_key* key, const aes128_key* ps3_key, const uint8_t* iv, sys_file pkg, int stream, uint64_t enc_offset, char* category, char* title)
+{
+    for (uint32_t item_index = 0; item_index < index->count; item_index++)
+    {
+        const pkg_item* it = index->items + item_index;
+        const aes128_key* item_key = it->psp_type == 0x90 ? key : ps3_key;
 
-        if (strcmp(name, "PARAM.SFO") == 0)
+        if (strcmp(index->names + it->name, "PARAM.SFO") == 0)
         {
+            if (stream)
+            {
+                // data skipped on the way to sfo is not kept, so nothing that is unpacked later can be before it
+                for (uint32_t other_index = 0; other_index < index->count; other_index++)
+                {
+                    const pkg_item* other = index->items + other_index;
+                    if (other->data_size != 0 && other->data_offset < it->data_offset && strncmp(index->names + other->name, "USRDIR/CONTENT/", 15) == 0)
+                    {
+                        sys_error("ERROR: PARAM.SFO is stored after game data, pkg cannot be read from stdin\n");
+                    }
+                }
+            }
+
             uint8_t sfo[16 * 1024];
-            if (data_size < 16)
+            if (it->data_size < 16)
             {
                 sys_error("ERROR: sfo information is too small\n");
             }
-            if (data_size > sizeof(sfo))
+            if (it->data_size > sizeof(sfo))
             {
                 sys_error("ERROR: sfo information is too big, pkg file is probably corrupted\n");
             }
 
-            sys_read(pkg, enc_offset + data_offset, sfo, (uint32_t)data_size);
-            aes128_ctr_xor(item_key, iv, data_offset / 16, sfo, (uint32_t)data_size);
+            sys_read(pkg, enc_offset + it->data_offset, sfo, (uint32_t)it->data_size);
+            aes128_ctr_xor(item_key, iv, it->data_offset / 16, sfo, (uint32_t)it->data_size);
 
-            parse_sfo_content(sfo, (uint32_t)data_size, category, title, NULL, NULL, NULL);
+            parse_sfo_content(sfo, (uint32_t)it->data_size, category, title, NULL, NULL, NULL);
             return;
         }
     }
 }
 
+static const pkg_item* sort_items;
+
+// folders first, then files in order they are stored in pkg
+static int compare_items(const void* a, const void* b)
+{
+    const pkg_item* ia = sort_items + *(const uint32_t*)a;
+    const pkg_item* ib = sort_items + *(const uint32_t*)b;
+
+    int folder_a = ia->flags == 4 || ia->flags == 18;
+    int folder_b = ib->flags == 4 || ib->flags == 18;
+    if (folder_a != folder_b)
+    {
+        return folder_b - folder_a;
+    }
+    if (ia->data_offset != ib->data_offset)
+    {
+        return ia->data_offset < ib->data_offset ? -1 : 1;
+    }
+    return *(const uint32_t*)a < *(const uint32_t*)b ? -1 : 1;
+}
+
 static const char* get_region(const char* id)
 {
     if (memcmp(id, "PCSE", 4) == 0 || memcmp(id, "PCSA", 4) == 0 ||
@@ -275,31 +372,218 @@ typedef enum {
     PKG_TYPE_PSX,
 } pkg_type;
 
+// copies raw pkg data to output file, adaptive level is decided from its first chunk
+static void copy_pkg_data(sys_file pkg, const char* path, int level, uint64_t offset, uint64_t size)
+{
+    uint8_t PKG_ALIGN(16) buffer[1 << 16];
+    uint32_t buffered = (uint32_t)min64(size, sizeof(buffer));
+    if (buffered != 0)
+    {
+        sys_read(pkg, offset, buffer, buffered);
+        level = out_level(level, buffer, buffered);
+    }
+    else
+    {
+        level = 0;
+    }
+
+    out_begin_file(path, level);
+    while (size != 0)
+    {
+        uint32_t chunk = buffered;
+        if (chunk == 0)
+        {
+            chunk = (uint32_t)min64(size, sizeof(buffer));
+            sys_read(pkg, offset, buffer, chunk);
+        }
+        buffered = 0;
+
+        out_write(buffer, chunk);
+        offset += chunk;
+        size -= chunk;
+    }
+    out_end_file();
+}
+
 int main(int argc, char* argv[])
 {
     sys_output_init();
 
-    int zipped = 1;
+    out_format format = OUT_FORMAT_ZIP;
     int listing = 0;
-    int cso = 0;
+    cso_options cso = { CSO_FORMAT_ISO, 0, 0, 1, CSO_DEFAULT_BLOCK_SIZE };
+    int follow = 0;
+    int zip_level = 0;
+    int iso2cso = 0;
+    int cso2iso = 0;
+    int direct = 0;
+    uint32_t readahead = 0;
     const char* pkg_arg = NULL;
     const char* zrif_arg = NULL;
+    const char* out_args[OUT_MAX_TARGETS];
+    uint32_t out_count = 0;
+    const char* extract = NULL;
+    int iso_folders = 0;
+    uint64_t split_size = 0;
+    uint32_t align = 0;
     for (int i = 1; i < argc; i++)
     {
         if (strcmp(argv[i], "-x") == 0)
         {
-            zipped = 0;
+            extract = extract ? extract : "";
+        }
+        else if (strncmp(argv[i], "--extract=", 10) == 0)
+        {
+            extract = argv[i] + 10;
+        }
+        else if (strcmp(argv[i], "--iso") == 0)
+        {
+            iso_folders = 1;
+        }
+        else if (strcmp(argv[i], "-o") == 0)
+        {
+            if (i + 1 == argc)
+            {
+                sys_error("ERROR: -o option requires output file name\n");
+            }
+            // one target is left for -x
+            if (out_count == OUT_MAX_TARGETS - 1)
+            {
+                sys_error("ERROR: too many -o options, max %u supported\n", OUT_MAX_TARGETS - 1);
+            }
+            out_args[out_count++] = argv[++i];
         }
         else if (strcmp(argv[i], "-l") == 0)
         {
             listing = 1;
         }
+        else if (strncmp(argv[i], "--format=", 9) == 0)
+        {
+            const char* arg = argv[i] + 9;
+            if (strcmp(arg, "zip") == 0)
+            {
+                format = OUT_FORMAT_ZIP;
+            }
+            else if (strcmp(arg, "tar") == 0)
+            {
+                format = OUT_FORMAT_TAR;
+            }
+            else if (strcmp(arg, "tar.zst") == 0)
+            {
+#if !defined(PKG2ZIP_ZSTD)
+                sys_error("ERROR: pkg2zip is built without zstd support\n");
+#endif
+                format = OUT_FORMAT_TAR_ZSTD;
+            }
+            else
+            {
+                sys_error("ERROR: unsupported output format '%s', use zip, tar or tar.zst\n", arg);
+            }
+        }
+        else if (strncmp(argv[i], "--split-size=", 13) == 0)
+        {
+            // size in bytes, or with k, m or g suffix
+            char* end;
+            split_size = strtoull(argv[i] + 13, &end, 10);
+            int shift = *end == 'k' || *end == 'K' ? 10 : *end == 'm' || *end == 'M' ? 20 : *end == 'g' || *end == 'G' ? 30 : 0;
+            end += shift != 0;
+            if (*end != 0 || split_size > (UINT64_MAX >> shift))
+            {
+                sys_error("ERROR: invalid split size '%s'\n", argv[i] + 13);
+            }
+            split_size <<= shift;
+            if (split_size < ZIP_MIN_SPLIT_SIZE)
+            {
+                sys_error("ERROR: split size must be at least %u bytes\n", ZIP_MIN_SPLIT_SIZE);
+            }
+        }
+        else if (strncmp(argv[i], "--align=", 8) == 0)
+        {
+            align = (uint32_t)atoi(argv[i] + 8);
+            if (align < 2 || align > ZIP_MAX_ALIGN || (align & (align - 1)) != 0)
+            {
+                sys_error("ERROR: alignment must be power of two between 2 and %u\n", ZIP_MAX_ALIGN);
+            }
+        }
+        else if (strcmp(argv[i], "--follow") == 0)
+        {
+            follow = 1;
+        }
+        else if (strcmp(argv[i], "--cso-dedup") == 0)
+        {
+            cso.dedup = 1;
+        }
+        else if (strncmp(argv[i], "--cso-block=", 12) == 0)
+        {
+            cso.block_size = (uint32_t)atoi(argv[i] + 12);
+            if (cso.block_size < CSO_DEFAULT_BLOCK_SIZE || cso.block_size > CSO_MAX_BLOCK_SIZE || (cso.block_size & (cso.block_size - 1)) != 0)
+            {
+                sys_error("ERROR: cso block size must be power of two between %u and %u\n", CSO_DEFAULT_BLOCK_SIZE, CSO_MAX_BLOCK_SIZE);
+            }
+        }
+        else if (strcmp(argv[i], "--iso2cso") == 0)
+        {
+            iso2cso = 1;
+        }
+        else if (strcmp(argv[i], "--cso2iso") == 0)
+        {
+            cso2iso = 1;
+        }
+        else if (strcmp(argv[i], "--cso-max") == 0)
+        {
+            cso.level = CSO_MAX_LEVEL;
+            cso.format = CSO_FORMAT_CSO;
+        }
+        else if (strcmp(argv[i], "--zso") == 0)
+        {
+            cso.format = CSO_FORMAT_ZSO;
+        }
+        else if (strcmp(argv[i], "--cso-v2") == 0)
+        {
+            cso.version = 2;
+        }
+        else if (strcmp(argv[i], "--direct") == 0)
+        {
+            direct = 1;
+        }
+        else if (strcmp(argv[i], "--readahead") == 0 || strncmp(argv[i], "--readahead=", 12) == 0)
+        {
+            // window size in MB
+            int window = argv[i][11] == '=' ? atoi(argv[i] + 12) : 8;
+            window = window > 1024 ? 1024 : window < 1 ? 1 : window;
+            readahead = (uint32_t)window << 20;
+        }
+        else if (strncmp(argv[i], "-z", 2) == 0)
+        {
+            // -zN deflates all files with level N, -za[N] only files that compress
+            // -zstd[N] and -zastd[N] does the same with zstd
+            const char* arg = argv[i] + 2;
+            int adaptive = *arg == 'a';
+            arg += adaptive;
+            if (strncmp(arg, "std", 3) == 0)
+            {
+#if !defined(PKG2ZIP_ZSTD)
+                sys_error("ERROR: pkg2zip is built without zstd support\n");
+#endif
+                arg += 3;
+                zip_level = *arg ? atoi(arg) : ZIP_ZSTD_DEFAULT_LEVEL;
+                zip_level = zip_level > ZIP_ZSTD_MAX_LEVEL ? ZIP_ZSTD_MAX_LEVEL : zip_level < 0 ? 0 : zip_level;
+                zip_level |= zip_level ? ZIP_LEVEL_ZSTD : 0;
+            }
+            else
+            {
+                zip_level = *arg ? atoi(arg) : adaptive ? MZ_DEFAULT_LEVEL : MZ_BEST_SPEED;
+                zip_level = zip_level > 9 ? 9 : zip_level < 0 ? 0 : zip_level;
+            }
+            zip_level |= adaptive && zip_level ? OUT_LEVEL_ADAPTIVE : 0;
+        }
         else if (strncmp(argv[i], "-c", 2) == 0)
         {
             if (argv[i][2] != 0)
             {
-                cso = atoi(argv[i] + 2);
-                cso = cso > 9 ? 9 : cso < 0 ? 0 : cso;
+                cso.level = atoi(argv[i] + 2);
+                cso.level = cso.level > CSO_MAX_LEVEL ? CSO_MAX_LEVEL : cso.level < 0 ? 0 : cso.level;
+                cso.format = cso.level ? CSO_FORMAT_CSO : CSO_FORMAT_ISO;
             }
         }
         else
@@ -315,6 +599,17 @@ int main(int argc, char* argv[])
             }
         }
     }
+    // archive is created when -o is used or when files are not extracted
+    int zipped = out_count != 0 || extract == NULL;
+    int streams = 0;
+    for (uint32_t i = 0; i < out_count; i++)
+    {
+        streams += strcmp(out_args[i], "-") == 0;
+    }
+    if (streams != 0 && listing == 0)
+    {
+        sys_output_stderr();
+    }
     if (listing == 0)
     {
         sys_output("pkg2zip v1.8\n");
@@ -322,7 +617,91 @@ int main(int argc, char* argv[])
     if (pkg_arg == NULL)
     {
         fprintf(stderr, "ERROR: no pkg file specified\n");
-        sys_error("Usage: %s [-x] [-l] [-c[N]] file.pkg [zRIF]\n", argv[0]);
+        sys_error("Usage: %s [-x] [--extract=DIR] [-l] [-z[a][std][N]] [-c[N]] [--cso-dedup] [--cso-block=N] [--cso-max] [--cso-v2] [--zso] [--iso] [--format=zip|tar|tar.zst] [--split-size=N[k|m|g]] [--align=N] [-o output.zip]... [--follow] [--direct] [--readahead[=MB]] file.pkg [zRIF]\n"
+            "       %s --iso2cso [-c[N]] [--cso-dedup] [--cso-block=N] [--cso-max] [--cso-v2] [--zso] input.iso output.cso\n"
+            "       %s --cso2iso input.cso output.iso\n", argv[0], argv[0], argv[0]);
+    }
+    if (streams > 1)
+    {
+        sys_error("ERROR: only one output can be streamed to stdout\n");
+    }
+    if (format != OUT_FORMAT_ZIP && zipped == 0)
+    {
+        sys_error("ERROR: --format option cannot be used together with -x without -o\n");
+    }
+    // tar files are not compressed individually, -zstdN only sets level for tar.zst format
+    int tar_level = ZIP_ZSTD_DEFAULT_LEVEL;
+    if (format != OUT_FORMAT_ZIP && zip_level != 0)
+    {
+        if (format != OUT_FORMAT_TAR_ZSTD || !(zip_level & ZIP_LEVEL_ZSTD) || (zip_level & OUT_LEVEL_ADAPTIVE))
+        {
+            sys_error("ERROR: -z option can be used with tar only as -zstdN together with --format=tar.zst\n");
+        }
+        tar_level = zip_level & ~ZIP_LEVEL_ZSTD;
+        zip_level = 0;
+    }
+    if (split_size != 0 && format != OUT_FORMAT_ZIP)
+    {
+        sys_error("ERROR: --split-size option can be used only with zip format\n");
+    }
+    if (align != 0 && format != OUT_FORMAT_ZIP)
+    {
+        sys_error("ERROR: --align option can be used only with zip format\n");
+    }
+    for (uint32_t i = 0; i < out_count; i++)
+    {
+        int local = strcmp(out_args[i], "-") != 0 && !http_is_url(out_args[i]);
+        // tar can contain cso, it is collected in memory before writing
+        if (!local && cso.format != CSO_FORMAT_ISO && format == OUT_FORMAT_ZIP)
+        {
+            sys_error("ERROR: cso output requires seekable file, cannot stream or upload it\n");
+        }
+        if (!local && split_size != 0)
+        {
+            sys_error("ERROR: split zip can be written only to local files\n");
+        }
+    }
+    if (cso.format == CSO_FORMAT_ZSO && cso.version != 1)
+    {
+        sys_error("ERROR: --cso-v2 option cannot be used together with --zso\n");
+    }
+    if (direct && follow)
+    {
+        sys_error("ERROR: --direct option cannot be used together with --follow\n");
+    }
+    if (direct)
+    {
+        sys_direct_io();
+    }
+    if (readahead)
+    {
+        sys_cache_window(readahead);
+    }
+
+    if (iso2cso || cso2iso)
+    {
+        if (zrif_arg == NULL)
+        {
+            sys_error("ERROR: conversion requires input and output file names\n");
+        }
+        if (cso2iso)
+        {
+            cso.format = CSO_FORMAT_ISO;
+        }
+        else if (cso.format == CSO_FORMAT_ISO)
+        {
+            cso.format = CSO_FORMAT_CSO;
+            cso.level = 9;
+        }
+        cso_convert(pkg_arg, zrif_arg, &cso);
+
+        if (readahead)
+        {
+            sys_output_stats();
+        }
+        sys_output("[*] done!\n");
+        sys_output_done();
+        return 0;
     }
 
     if (listing == 0)
@@ -333,6 +712,17 @@ int main(int argc, char* argv[])
     uint64_t pkg_size;
     sys_file pkg = sys_open(pkg_arg, &pkg_size);
 
+    // when reading from stream, keep everything until all metadata is parsed
+    int pkg_stream = !sys_seekable(pkg);
+    if (pkg_stream)
+    {
+        sys_retain(pkg, 1);
+    }
+    else if (follow)
+    {
+        sys_follow(pkg);
+    }
+
     uint8_t pkg_header[PKG_HEADER_SIZE + PKG_HEADER_EXT_SIZE];
     sys_read(pkg, 0, pkg_header, sizeof(pkg_header));
 
@@ -351,11 +741,17 @@ int main(int argc, char* argv[])
     const uint8_t* iv = pkg_header + 0x70;
     int key_type = pkg_header[0xe7] & 7;
 
+    // size of stream or file that is still being downloaded is known only from its header
+    if (pkg_stream || follow)
+    {
+        pkg_size = total_size;
+    }
+
     if (pkg_size < total_size)
     {
         sys_error("ERROR: pkg file is too small\n");
     }
-    if (pkg_size < enc_offset + item_count * 32)
+    if (enc_offset > pkg_size || pkg_size - enc_offset < (uint64_t)item_count * 32)
     {
         sys_error("ERROR: pkg file is too small\n");
     }
@@ -392,6 +788,11 @@ int main(int argc, char* argv[])
         meta_offset += 2 * sizeof(uint32_t) + size;
     }
 
+    if (pkg_size - enc_offset < (uint64_t)items_offset + items_size)
+    {
+        sys_error("ERROR: pkg file is too small\n");
+    }
+
     pkg_type type;
 
     // http://www.psdevwiki.com/ps3/PKG_files
@@ -450,6 +851,16 @@ int main(int argc, char* argv[])
     aes128_key key;
     aes128_init(&key, main_key);
 
+    pkg_index index;
+    read_items(&index, &key, &ps3_key, type == PKG_TYPE_PSP || type == PKG_TYPE_PSX, iv, pkg, pkg_size, enc_offset, items_offset, item_count);
+
+    if (pkg_stream && items_size != 0)
+    {
+        // head.bin also includes padding after last item name, read it while it is still retained
+        uint8_t last;
+        sys_read(pkg, enc_offset + items_size - 1, &last, 1);
+    }
+
     char content[256];
     char title[256];
     char category[256];
@@ -465,7 +876,12 @@ int main(int argc, char* argv[])
 
     if (type == PKG_TYPE_PSP || type == PKG_TYPE_PSX)
     {
-        find_psp_sfo(&key, &ps3_key, iv, pkg, pkg_size, enc_offset, items_offset, item_count, category, title);
+        if (pkg_stream)
+        {
+            // sfo is read directly from stream, only header and item table stays in memory
+            sys_retain(pkg, 0);
+        }
+        find_psp_sfo(&index, &key, &ps3_key, iv, pkg, pkg_stream, enc_offset, category, title);
         id = (char*)pkg_header + 0x37;
     }
     else // Vita
@@ -497,7 +913,12 @@ int main(int argc, char* argv[])
         }
     }
 
-    const char* ext = zipped ? ".zip" : "";
+    if (pkg_stream)
+    {
+        sys_retain(pkg, 0);
+    }
+
+    const char* ext = zipped == 0 ? "" : format == OUT_FORMAT_ZIP ? ".zip" : format == OUT_FORMAT_TAR ? ".tar" : ".tar.zst";
 
     char root[1024];
     if (type == PKG_TYPE_PSP)
@@ -563,9 +984,14 @@ int main(int argc, char* argv[])
         sys_error("ERROR: unsupported type\n");
     }
 
+    if (out_count == 0 && zipped)
+    {
+        out_args[out_count++] = root;
+    }
+
     if (listing && zipped)
     {
-        sys_output("%s\n", root);
+        sys_output("%s\n", out_args[0]);
         exit(0);
     }
     else if (listing && zipped == 0)
@@ -573,14 +999,42 @@ int main(int argc, char* argv[])
         sys_error("ERROR: Listing option without creating zip is useless\n");
     }
 
-    if (zipped)
+    // every file is decrypted once and written to all archives and extracted folder
+    for (uint32_t i = 0; i < out_count; i++)
     {
-        sys_output("[*] creating '%s' archive\n", root);
+        if (strcmp(out_args[i], "-") == 0)
+        {
+            sys_output("[*] streaming archive to stdout\n");
+        }
+        else
+        {
+            sys_output("[*] creating '%s' archive\n", out_args[i]);
+        }
+        out_begin(out_args[i], format, tar_level, split_size, align);
+    }
+    if (extract != NULL)
+    {
+        if (extract[0] != 0)
+        {
+            sys_output("[*] extracting to '%s' folder\n", extract);
+        }
+        out_begin(extract, OUT_FORMAT_FOLDER, 0, 0, 0);
     }
-
-    out_begin(root, zipped);
     root[0] = 0;
 
+    if (zipped)
+    {
+        // zip contains almost whole pkg (items, head.bin and tail.bin) and headers for each item
+        uint64_t expected = pkg_size;
+        for (uint32_t i = 0; i < index.count; i++)
+        {
+            expected += ZIP_ITEM_OVERHEAD + 2 * index.items[i].name_size;
+        }
+        out_select(out_targets() & ~out_folders());
+        out_reserve(expected);
+        out_select(out_targets());
+    }
+
     if (type == PKG_TYPE_PSP)
     {
         snprintf(root, sizeof(root), "pspemu/ISO");
@@ -662,33 +1116,27 @@ int main(int argc, char* argv[])
 
     sys_output_progress_init(pkg_size);
 
+    // stream can be read only forward and growing file is written sequentially,
+    // so process items in same order as their data is stored
+    uint32_t* order = sys_realloc(NULL, (item_count + 1) * sizeof(uint32_t));
     for (uint32_t item_index = 0; item_index < item_count; item_index++)
     {
-        uint8_t item[32];
-        uint64_t item_offset = items_offset + item_index * 32;
-        sys_read(pkg, enc_offset + item_offset, item, sizeof(item));
-        aes128_ctr_xor(&key, iv, item_offset / 16, item, sizeof(item));
-
-        uint32_t name_offset = get32be(item + 0);
-        uint32_t name_size = get32be(item + 4);
-        uint64_t data_offset = get64be(item + 8);
-        uint64_t data_size = get64be(item + 16);
-        uint8_t psp_type = item[24];
-        uint8_t flags = item[27];
+        order[item_index] = item_index;
+    }
+    if (pkg_stream || follow)
+    {
+        sort_items = index.items;
+        qsort(order, item_count, sizeof(*order), compare_items);
+    }
 
-        assert(name_offset % 16 == 0);
-        assert(data_offset % 16 == 0);
+    for (uint32_t item_index = 0; item_index < item_count; item_index++)
+    {
+        const pkg_item* it = index.items + order[item_index];
 
-        if (pkg_size < enc_offset + name_offset + name_size ||
-            pkg_size < enc_offset + data_offset + data_size)
-        {
-            sys_error("ERROR: pkg file is too short, possibly corrupted\n");
-        }
-
-        if (name_size >= ZIP_MAX_FILENAME)
-        {
-            sys_error("ERROR: pkg file contains file with very long name\n");
-        }
+        uint64_t data_offset = it->data_offset;
+        uint64_t data_size = it->data_size;
+        uint8_t psp_type = it->psp_type;
+        uint8_t flags = it->flags;
 
         const aes128_key* item_key;
         if (type == PKG_TYPE_PSP || type == PKG_TYPE_PSX)
@@ -701,9 +1149,7 @@ int main(int argc, char* argv[])
         }
 
         char name[ZIP_MAX_FILENAME];
-        sys_read(pkg, enc_offset + name_offset, name, name_size);
-        aes128_ctr_xor(item_key, iv, name_offset / 16, (uint8_t*)name, name_size);
-        name[name_size] = 0;
+        memcpy(name, index.names + it->name, it->name_size + 1);
 
         // sys_output("[%u/%u] %s\n", item_index + 1, item_count, name);
 
@@ -766,8 +1212,10 @@ int main(int argc, char* argv[])
             {
                 if (strcmp("USRDIR/CONTENT/EBOOT.PBP", name) == 0)
                 {
-                    snprintf(path, sizeof(path), "pspemu/ISO/%s [%.9s].%s", title, id, cso ? "cso" : "iso");
-                    unpack_psp_eboot(path, item_key, iv, pkg, enc_offset, data_offset, data_size, cso);
+                    snprintf(path, sizeof(path), "pspemu/ISO/%s [%.9s]", title, id);
+                    // iso image is always deflated in zip, unless other compression is requested
+                    int iso_level = zip_level ? zip_level & ~OUT_LEVEL_ADAPTIVE : MZ_BEST_SPEED;
+                    unpack_psp_eboot(path, item_key, iv, pkg, enc_offset, data_offset, data_size, &cso, iso_level, iso_folders ? out_folders() : 0);
                     continue;
                 }
                 else if (strcmp("USRDIR/CONTENT/PSP-KEY.EDAT", name) == 0)
@@ -797,18 +1245,61 @@ int main(int argc, char* argv[])
 
             uint64_t offset = data_offset;
 
-            out_begin_file(path, 0);
-            while (data_size != 0)
-            {
-                uint8_t PKG_ALIGN(16) buffer[1 << 16];
-                uint32_t size = (uint32_t)min64(data_size, sizeof(buffer));
-                sys_output_progress(enc_offset + offset);
-                sys_read(pkg, enc_offset + offset, buffer, size);
+            uint8_t PKG_ALIGN(16) buffer[1 << 16];
+            uint32_t buffered = 0;
 
+            int level = zip_level;
+            if (zipped && (level & OUT_LEVEL_ADAPTIVE))
+            {
+                // first chunk is decrypted before file is started, to check if it compresses
+                buffered = (uint32_t)min64(data_size, sizeof(buffer));
+                sys_read(pkg, enc_offset + offset, buffer, buffered);
                 if (decrypt)
                 {
-                    aes128_ctr_xor(item_key, iv, offset / 16, buffer, size);
+                    aes128_ctr_xor(item_key, iv, offset / 16, buffer, buffered);
                 }
+                level = out_level(level, buffer, buffered);
+            }
+
+            out_begin_file(path, level);
+
+            // large files are read directly into mapped output and decrypted there
+            uint8_t* mapped = out_map(data_size);
+            if (mapped)
+            {
+                while (data_size != 0)
+                {
+                    uint32_t size = (uint32_t)min64(data_size, 1 << 20);
+                    sys_output_progress(enc_offset + offset);
+                    sys_read(pkg, enc_offset + offset, mapped, size);
+
+                    if (decrypt)
+                    {
+                        aes128_ctr_xor(item_key, iv, offset / 16, mapped, size);
+                    }
+
+                    mapped += size;
+                    offset += size;
+                    data_size -= size;
+                }
+            }
+
+            out_reserve(data_size);
+            while (data_size != 0)
+            {
+                uint32_t size = buffered;
+                if (size == 0)
+                {
+                    size = (uint32_t)min64(data_size, sizeof(buffer));
+                    sys_output_progress(enc_offset + offset);
+                    sys_read(pkg, enc_offset + offset, buffer, size);
+
+                    if (decrypt)
+                    {
+                        aes128_ctr_xor(item_key, iv, offset / 16, buffer, size);
+                    }
+                }
+                buffered = 0;
 
                 out_write(buffer, size);
                 offset += size;
@@ -832,40 +1323,18 @@ int main(int argc, char* argv[])
         sys_output("[*] creating sce_sys/package/head.bin\n");
         snprintf(path, sizeof(path), "%s/sce_sys/package/head.bin", root);
 
-        out_begin_file(path, 0);
-        uint64_t head_size = enc_offset + items_size;
-        uint64_t head_offset = 0;
-        while (head_size != 0)
-        {
-            uint8_t PKG_ALIGN(16) buffer[1 << 16];
-            uint32_t size = (uint32_t)min64(head_size, sizeof(buffer));
-            sys_read(pkg, head_offset, buffer, size);
-            out_write(buffer, size);
-            head_size -= size;
-            head_offset += size;
-        }
-        out_end_file();
+        copy_pkg_data(pkg, path, zip_level, 0, enc_offset + items_size);
 
         sys_output("[*] creating sce_sys/package/tail.bin\n");
         snprintf(path, sizeof(path), "%s/sce_sys/package/tail.bin", root);
 
-        out_begin_file(path, 0);
-        uint64_t tail_offset = enc_offset + enc_size;
-        while (tail_offset != pkg_size)
-        {
-            uint8_t PKG_ALIGN(16) buffer[1 << 16];
-            uint32_t size = (uint32_t)min64(pkg_size - tail_offset, sizeof(buffer));
-            sys_read(pkg, tail_offset, buffer, size);
-            out_write(buffer, size);
-            tail_offset += size;
-        }
-        out_end_file();
+        copy_pkg_data(pkg, path, zip_level, enc_offset + enc_size, pkg_size - enc_offset - enc_size);
 
         sys_output("[*] creating sce_sys/package/stat.bin\n");
         snprintf(path, sizeof(path), "%s/sce_sys/package/stat.bin", root);
 
         uint8_t stat[768] = { 0 };
-        out_begin_file(path, 0);
+        out_begin_file(path, out_level(zip_level, stat, sizeof(stat)));
         out_write(stat, sizeof(stat));
         out_end_file();
     }
@@ -887,7 +1356,7 @@ int main(int argc, char* argv[])
             snprintf(path, sizeof(path), "%s/sce_sys/package/work.bin", root);
         }
 
-        out_begin_file(path, 0);
+        out_begin_file(path, out_level(zip_level, rif, rif_size));
         out_write(rif, rif_size);
         out_end_file();
     }
@@ -912,7 +1381,7 @@ int main(int argc, char* argv[])
 
         sys_output("[*] creating RW/System/content_id\n");
         snprintf(path, sizeof(path), "%s/RW/System/content_id", root);
-        out_begin_file(path, 0);
+        out_begin_file(path, out_level(zip_level, pkg_header + 0x30, 0x30));
         out_write(pkg_header + 0x30, 0x30);
         out_end_file();
 
@@ -920,18 +1389,27 @@ int main(int argc, char* argv[])
         snprintf(path, sizeof(path), "%s/RW/System/pm.dat", root);
 
         uint8_t pm[1 << 16] = { 0 };
-        out_begin_file(path, 0);
+        out_begin_file(path, out_level(zip_level, pm, sizeof(pm)));
         out_write(pm, sizeof(pm));
         out_end_file();
     }
 
     out_end();
 
+    sys_realloc(order, 0);
+    sys_realloc(index.names, 0);
+    sys_realloc(index.items, 0);
+
     if (type == PKG_TYPE_VITA_APP || type == PKG_TYPE_VITA_PATCH)
     {
         sys_output("[*] minimum fw version required: %s\n", min_version);
     }
 
+    if (readahead)
+    {
+        sys_output_stats();
+    }
+
     sys_output("[*] done!\n");
     sys_output_done();
 }
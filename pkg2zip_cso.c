@@ -0,0 +1,686 @@
+#include "pkg2zip_cso.h"
+#include "pkg2zip_out.h"
+#include "pkg2zip_crc32.h"
+#include "pkg2zip_deflate.h"
+#include "pkg2zip_lz4.h"
+#include "pkg2zip_sys.h"
+#include "miniz_tdef.h"
+#include "puff.h"
+
+#include <string.h>
+
+#define CSO_HEADER_SIZE 24
+
+// recently compressed blocks, to not compress repeated blocks again
+#define CSO_CACHE_SIZE 64
+
+typedef struct {
+    uint64_t hash;
+    int used;
+    int32_t slot; // >= 0 when compressed data will come from this slot of current batch
+    uint32_t size; // 0 = block does not compress and is stored raw
+    uint8_t* data;
+    uint8_t* compressed;
+} cso_cache_entry;
+
+// with dedup every unique block is remembered, up to this much memory
+#define CSO_DEDUP_MAX_MEMORY (256 * 1024 * 1024)
+
+typedef struct {
+    uint64_t hash;
+    uint32_t offset; // in dedup memory, block followed by its compressed data
+    uint32_t size; // 0 = block does not compress and is stored raw
+} cso_dedup_entry;
+
+// blocks are compressed in batches of this size, spread over all cpus
+#define CSO_BATCH_SIZE (4 * 1024 * 1024)
+#define CSO_MAX_THREADS 64
+
+// how block in batch gets its compressed data
+#define CSO_BLOCK_READY 0 // already known, from zero block, cache or dedup table
+#define CSO_BLOCK_COMPRESS 1 // needs to be compressed
+#define CSO_BLOCK_COPY 2 // same as earlier block in batch that is being compressed
+
+typedef struct {
+    uint8_t state;
+    int32_t source; // for CSO_BLOCK_COPY
+    uint64_t hash;
+    uint32_t size; // 0 = block does not compress and is stored raw
+} cso_batch_block;
+
+typedef struct {
+    cso_writer* cso;
+    uint32_t index;
+    tdefl_compressor* compressor;
+    deflate_optimal* optimal; // for -c10
+} cso_worker;
+
+struct cso_writer
+{
+    cso_format format;
+    uint64_t size;
+    uint32_t initial_size;
+    mz_uint flags;
+    int optimal;
+    int version;
+    uint32_t block_size;
+    uint32_t* block;
+    uint32_t index;
+    uint32_t offset;
+
+    // iso data is collected in batch until it is full, last block may be partial
+    uint32_t batch_count;
+    uint32_t batch_max;
+    uint32_t pending_size;
+    uint8_t* batch_data;
+    uint8_t* batch_compressed;
+    cso_batch_block* batch;
+
+    uint32_t thread_count;
+    uint32_t batch_threads;
+    cso_worker* workers;
+
+    // compressed all-zero block
+    uint32_t zero_size;
+    uint8_t* zero;
+
+    cso_cache_entry* cache;
+    uint8_t* cache_memory;
+
+    // all unique blocks with their compressed data, open addressing hash table into memory
+    int dedup;
+    uint32_t dedup_count;
+    uint32_t dedup_capacity;
+    cso_dedup_entry* dedup_table;
+    uint8_t* dedup_memory;
+    uint32_t dedup_memory_size;
+    uint32_t dedup_memory_allocated;
+    uint32_t dedup_hits;
+};
+
+// returns 0 if block does not compress
+static uint32_t cso_deflate(tdefl_compressor* compressor, mz_uint flags, const uint8_t* data, uint32_t size, uint8_t* output)
+{
+    size_t insize = size;
+    size_t outsize = size;
+
+    tdefl_init(compressor, flags);
+    tdefl_status st = tdefl_compress(compressor, data, &insize, output, &outsize, TDEFL_FINISH);
+    // v2 readers treat full size blocks as raw data
+    return st == TDEFL_STATUS_DONE && outsize < size ? (uint32_t)outsize : 0;
+}
+
+// returns 0 if block does not compress
+static uint32_t cso_compress(const cso_writer* cso, cso_worker* worker, const uint8_t* data, uint8_t* output)
+{
+    uint32_t size = cso->block_size;
+    if (cso->format == CSO_FORMAT_ZSO)
+    {
+        return lz4_compress(data, size, output, size - 1);
+    }
+    if (cso->optimal)
+    {
+        return deflate_optimal_compress(worker->optimal, data, size, output, size - 1);
+    }
+    return cso_deflate(worker->compressor, cso->flags, data, size, output);
+}
+
+static void cso_compress_batch(void* arg)
+{
+    cso_worker* worker = arg;
+    cso_writer* cso = worker->cso;
+
+    // each thread takes every batch_threads'th block
+    for (uint32_t i = worker->index; i < cso->batch_count; i += cso->batch_threads)
+    {
+        cso_batch_block* block = cso->batch + i;
+        if (block->state == CSO_BLOCK_COMPRESS)
+        {
+            uint8_t* data = cso->batch_data + (size_t)i * cso->block_size;
+            uint8_t* compressed = cso->batch_compressed + (size_t)i * cso->block_size;
+            block->size = cso_compress(cso, worker, data, compressed);
+        }
+    }
+}
+
+cso_writer* cso_begin(const cso_options* options, uint64_t size)
+{
+    uint32_t block_size = options->block_size;
+    uint32_t block_count = (uint32_t)(1 + (size + block_size - 1) / block_size);
+
+    cso_writer* cso = sys_realloc(NULL, sizeof(*cso));
+    cso->format = options->format;
+    cso->size = size;
+    cso->initial_size = CSO_HEADER_SIZE + block_count * sizeof(uint32_t);
+    cso->flags = tdefl_create_comp_flags_from_zip_params(options->level, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
+    cso->optimal = cso->format == CSO_FORMAT_CSO && options->level >= CSO_MAX_LEVEL;
+    cso->version = options->version;
+    cso->block_size = block_size;
+    cso->block = sys_realloc(NULL, block_count * sizeof(uint32_t));
+    cso->index = 0;
+    cso->offset = cso->initial_size;
+
+    cso->thread_count = min32(sys_cpu_count(), CSO_MAX_THREADS);
+    cso->workers = sys_realloc(NULL, cso->thread_count * sizeof(cso_worker));
+    for (uint32_t i = 0; i < cso->thread_count; i++)
+    {
+        cso_worker* worker = cso->workers + i;
+        worker->cso = cso;
+        worker->index = i;
+        // tdefl state is too large for stack of secondary threads
+        worker->compressor = cso->format == CSO_FORMAT_CSO && !cso->optimal ? sys_realloc(NULL, sizeof(tdefl_compressor)) : NULL;
+        worker->optimal = cso->optimal ? deflate_optimal_create(block_size) : NULL;
+    }
+
+    cso->batch_max = CSO_BATCH_SIZE / block_size;
+    cso->batch_max = cso->batch_max < 4 * cso->thread_count ? 4 * cso->thread_count : cso->batch_max;
+    cso->batch_count = 0;
+    cso->pending_size = 0;
+    cso->batch_data = sys_realloc(NULL, (size_t)cso->batch_max * block_size);
+    cso->batch_compressed = sys_realloc(NULL, (size_t)cso->batch_max * block_size);
+    cso->batch = sys_realloc(NULL, cso->batch_max * sizeof(cso_batch_block));
+
+    // padding in UMD images has a lot of zero blocks, they all compress to same data
+    uint8_t* zero = cso->batch_data;
+    memset(zero, 0, block_size);
+    cso->zero = sys_realloc(NULL, block_size);
+    cso->zero_size = cso_compress(cso, cso->workers, zero, cso->zero);
+
+    cso->cache = sys_realloc(NULL, CSO_CACHE_SIZE * sizeof(cso_cache_entry));
+    cso->cache_memory = sys_realloc(NULL, CSO_CACHE_SIZE * 2 * block_size);
+    for (size_t i = 0; i < CSO_CACHE_SIZE; i++)
+    {
+        cso->cache[i].used = 0;
+        cso->cache[i].data = cso->cache_memory + i * 2 * block_size;
+        cso->cache[i].compressed = cso->cache[i].data + block_size;
+    }
+
+    cso->dedup = options->dedup;
+    cso->dedup_count = 0;
+    cso->dedup_capacity = 0;
+    cso->dedup_table = NULL;
+    cso->dedup_memory = NULL;
+    cso->dedup_memory_size = 0;
+    cso->dedup_memory_allocated = 0;
+    cso->dedup_hits = 0;
+
+    // index is written at the beginning after all data is compressed
+    out_set_offset(cso->initial_size);
+    return cso;
+}
+
+static void cso_done(cso_writer* cso)
+{
+    if (cso->dedup)
+    {
+        sys_output("[*] %u blocks were deduplicated\n", cso->dedup_hits);
+    }
+    if (cso->dedup_table)
+    {
+        sys_realloc(cso->dedup_table, 0);
+        sys_realloc(cso->dedup_memory, 0);
+    }
+    sys_realloc(cso->cache_memory, 0);
+    sys_realloc(cso->cache, 0);
+    sys_realloc(cso->zero, 0);
+    for (uint32_t i = 0; i < cso->thread_count; i++)
+    {
+        if (cso->workers[i].compressor)
+        {
+            sys_realloc(cso->workers[i].compressor, 0);
+        }
+        if (cso->workers[i].optimal)
+        {
+            deflate_optimal_free(cso->workers[i].optimal);
+        }
+    }
+    sys_realloc(cso->workers, 0);
+    sys_realloc(cso->batch, 0);
+    sys_realloc(cso->batch_compressed, 0);
+    sys_realloc(cso->batch_data, 0);
+    sys_realloc(cso->block, 0);
+    sys_realloc(cso, 0);
+}
+
+static cso_dedup_entry* cso_dedup_find(cso_writer* cso, uint64_t hash, const uint8_t* data)
+{
+    uint32_t mask = cso->dedup_capacity - 1;
+    for (uint32_t i = (uint32_t)hash & mask; ; i = (i + 1) & mask)
+    {
+        cso_dedup_entry* entry = cso->dedup_table + i;
+        if (entry->hash == 0)
+        {
+            return entry;
+        }
+        if (entry->hash == hash && memcmp(cso->dedup_memory + entry->offset, data, cso->block_size) == 0)
+        {
+            return entry;
+        }
+    }
+}
+
+static void cso_dedup_add(cso_writer* cso, uint64_t hash, const uint8_t* data, const uint8_t* compressed, uint32_t size)
+{
+    uint32_t needed = cso->block_size + size;
+    if (cso->dedup_memory_size + needed > CSO_DEDUP_MAX_MEMORY)
+    {
+        return;
+    }
+    // same block can be compressed more than once in one batch
+    if (cso->dedup_table && cso_dedup_find(cso, hash, data)->hash != 0)
+    {
+        return;
+    }
+
+    if (2 * (cso->dedup_count + 1) > cso->dedup_capacity)
+    {
+        cso_dedup_entry* old_table = cso->dedup_table;
+        uint32_t old_capacity = cso->dedup_capacity;
+
+        cso->dedup_capacity = old_capacity ? 2 * old_capacity : 4096;
+        cso->dedup_table = sys_realloc(NULL, cso->dedup_capacity * sizeof(cso_dedup_entry));
+        memset(cso->dedup_table, 0, cso->dedup_capacity * sizeof(cso_dedup_entry));
+        for (uint32_t i = 0; i < old_capacity; i++)
+        {
+            if (old_table[i].hash != 0)
+            {
+                *cso_dedup_find(cso, old_table[i].hash, cso->dedup_memory + old_table[i].offset) = old_table[i];
+            }
+        }
+        if (old_table)
+        {
+            sys_realloc(old_table, 0);
+        }
+    }
+
+    if (cso->dedup_memory_size + needed > cso->dedup_memory_allocated)
+    {
+        cso->dedup_memory_allocated = min32(2 * (cso->dedup_memory_size + needed), CSO_DEDUP_MAX_MEMORY);
+        cso->dedup_memory = sys_realloc(cso->dedup_memory, cso->dedup_memory_allocated);
+    }
+
+    cso_dedup_entry* entry = cso_dedup_find(cso, hash, data);
+    entry->hash = hash;
+    entry->offset = cso->dedup_memory_size;
+    entry->size = size;
+    memcpy(cso->dedup_memory + cso->dedup_memory_size, data, cso->block_size);
+    memcpy(cso->dedup_memory + cso->dedup_memory_size + cso->block_size, compressed, size);
+    cso->dedup_memory_size += needed;
+    cso->dedup_count++;
+}
+
+static uint64_t cso_hash(const uint8_t* data, uint32_t size)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i += 8)
+    {
+        hash = (hash ^ get64le(data + i)) * 1099511628211ULL;
+    }
+    hash ^= hash >> 32;
+    // 0 marks empty slot in dedup table
+    return hash ? hash : 1;
+}
+
+static void cso_write_batch(cso_writer* cso)
+{
+    uint32_t block_size = cso->block_size;
+
+    // first find blocks with already known compressed data
+    uint32_t compress_count = 0;
+    for (uint32_t i = 0; i < cso->batch_count; i++)
+    {
+        cso_batch_block* block = cso->batch + i;
+        const uint8_t* data = cso->batch_data + (size_t)i * block_size;
+        uint8_t* compressed = cso->batch_compressed + (size_t)i * block_size;
+
+        block->state = CSO_BLOCK_READY;
+        if (is_zero(data, block_size))
+        {
+            block->size = cso->zero_size;
+            memcpy(compressed, cso->zero, cso->zero_size);
+            continue;
+        }
+
+        block->hash = cso_hash(data, block_size);
+        cso_cache_entry* entry = cso->cache + block->hash % CSO_CACHE_SIZE;
+        if (entry->used && entry->hash == block->hash && memcmp(entry->data, data, block_size) == 0)
+        {
+            if (entry->slot >= 0)
+            {
+                block->state = CSO_BLOCK_COPY;
+                block->source = entry->slot;
+            }
+            else
+            {
+                block->size = entry->size;
+                memcpy(compressed, entry->compressed, entry->size);
+            }
+            cso->dedup_hits += cso->dedup;
+            continue;
+        }
+
+        entry->used = 1;
+        entry->hash = block->hash;
+        memcpy(entry->data, data, block_size);
+
+        cso_dedup_entry* found = cso->dedup_table ? cso_dedup_find(cso, block->hash, data) : NULL;
+        if (found && found->hash != 0)
+        {
+            entry->slot = -1;
+            entry->size = found->size;
+            memcpy(entry->compressed, cso->dedup_memory + found->offset + block_size, found->size);
+
+            block->size = found->size;
+            memcpy(compressed, entry->compressed, found->size);
+            cso->dedup_hits++;
+            continue;
+        }
+
+        entry->slot = (int32_t)i;
+        block->state = CSO_BLOCK_COMPRESS;
+        compress_count++;
+    }
+
+    // then compress rest of them on all cpus
+    cso->batch_threads = min32(cso->thread_count, compress_count);
+    if (cso->batch_threads != 0)
+    {
+        sys_thread threads[CSO_MAX_THREADS];
+        for (uint32_t t = 1; t < cso->batch_threads; t++)
+        {
+            threads[t] = sys_thread_start(cso_compress_batch, cso->workers + t);
+        }
+        cso_compress_batch(cso->workers);
+        for (uint32_t t = 1; t < cso->batch_threads; t++)
+        {
+            sys_thread_join(threads[t]);
+        }
+    }
+
+    // and write all of them in order
+    for (uint32_t i = 0; i < cso->batch_count; i++)
+    {
+        cso_batch_block* block = cso->batch + i;
+        const uint8_t* data = cso->batch_data + (size_t)i * block_size;
+        uint8_t* compressed = cso->batch_compressed + (size_t)i * block_size;
+
+        if (block->state == CSO_BLOCK_COMPRESS)
+        {
+            cso_cache_entry* entry = cso->cache + block->hash % CSO_CACHE_SIZE;
+            if (entry->slot == (int32_t)i)
+            {
+                entry->slot = -1;
+                entry->size = block->size;
+                memcpy(entry->compressed, compressed, block->size);
+            }
+            if (cso->dedup)
+            {
+                cso_dedup_add(cso, block->hash, data, compressed, block->size);
+            }
+        }
+        else if (block->state == CSO_BLOCK_COPY)
+        {
+            block->size = cso->batch[block->source].size;
+            memcpy(compressed, cso->batch_compressed + (size_t)block->source * block_size, block->size);
+        }
+
+        cso->block[cso->index] = cso->offset;
+        if (block->size != 0)
+        {
+            out_write(compressed, block->size);
+            cso->offset += block->size;
+        }
+        else
+        {
+            // v2 recognizes raw blocks by their size, in v1 top bit is set
+            if (cso->version == 1)
+            {
+                cso->block[cso->index] |= 0x80000000;
+            }
+            out_write(data, block_size);
+            cso->offset += block_size;
+        }
+        cso->index++;
+    }
+
+    cso->batch_count = 0;
+}
+
+void cso_write(cso_writer* cso, const uint8_t* data, uint32_t size)
+{
+    uint32_t block_size = cso->block_size;
+
+    while (size != 0)
+    {
+        uint8_t* block = cso->batch_data + (size_t)cso->batch_count * block_size;
+        uint32_t copy = min32(size, block_size - cso->pending_size);
+        memcpy(block + cso->pending_size, data, copy);
+        cso->pending_size += copy;
+        data += copy;
+        size -= copy;
+
+        if (cso->pending_size == block_size)
+        {
+            cso->pending_size = 0;
+            if (++cso->batch_count == cso->batch_max)
+            {
+                cso_write_batch(cso);
+            }
+        }
+    }
+}
+
+static void cso_flush(cso_writer* cso)
+{
+    // last block is padded with zeros, readers always decompress full block
+    if (cso->pending_size != 0)
+    {
+        uint8_t* block = cso->batch_data + (size_t)cso->batch_count * cso->block_size;
+        memset(block + cso->pending_size, 0, cso->block_size - cso->pending_size);
+        cso->pending_size = 0;
+        cso->batch_count++;
+    }
+    cso_write_batch(cso);
+    cso->block[cso->index++] = cso->offset;
+}
+
+void cso_end(cso_writer* cso)
+{
+    cso_flush(cso);
+
+    uint8_t cso_header[CSO_HEADER_SIZE];
+    memset(cso_header, 0, sizeof(cso_header));
+    memcpy(cso_header, cso->format == CSO_FORMAT_ZSO ? "ZISO" : "CISO", 4);
+    // header size
+    set32le(cso_header + 4, sizeof(cso_header));
+    // original size
+    set64le(cso_header + 8, cso->size);
+    // block size
+    set32le(cso_header + 16, cso->block_size);
+    // version
+    cso_header[20] = (uint8_t)cso->version;
+
+    out_write_at(0, cso_header, sizeof(cso_header));
+    out_write_at(sizeof(cso_header), cso->block, cso->index * sizeof(uint32_t));
+
+    crc32_ctx cheader;
+    crc32_init(&cheader);
+    crc32_update(&cheader, cso_header, sizeof(cso_header));
+    crc32_update(&cheader, cso->block, cso->index * sizeof(uint32_t));
+
+    uint32_t header_crc32 = crc32_done(&cheader);
+    uint32_t data_crc32 = out_zip_get_crc32();
+    uint32_t data_len = (uint32_t)(cso->offset - cso->initial_size);
+
+    uint32_t crc32 = crc32_combine(header_crc32, data_crc32, data_len);
+    out_zip_set_crc32(crc32);
+
+    cso_done(cso);
+}
+
+// plain iso input is read in chunks of this size
+#define CSO_CONVERT_CHUNK_SIZE (1024 * 1024)
+
+// other tools can create files with larger blocks than pkg2zip writes
+#define CSO_MAX_READ_BLOCK_SIZE (1024 * 1024)
+
+void cso_convert(const char* input, const char* output, const cso_options* options)
+{
+    uint64_t input_size;
+    sys_file file = sys_open(input, &input_size);
+    if (!sys_seekable(file))
+    {
+        sys_error("ERROR: input file for conversion must be seekable\n");
+    }
+
+    cso_format format = CSO_FORMAT_ISO;
+    uint64_t size = input_size;
+    uint32_t block_size = CSO_CONVERT_CHUNK_SIZE;
+    uint32_t block_count = 0;
+    uint32_t version = 0;
+    uint32_t shift = 0;
+    uint32_t* index = NULL;
+
+    uint8_t header[CSO_HEADER_SIZE];
+    if (input_size >= sizeof(header))
+    {
+        sys_read(file, 0, header, sizeof(header));
+        if (memcmp(header, "CISO", 4) == 0)
+        {
+            format = CSO_FORMAT_CSO;
+        }
+        else if (memcmp(header, "ZISO", 4) == 0)
+        {
+            format = CSO_FORMAT_ZSO;
+        }
+    }
+
+    if (format != CSO_FORMAT_ISO)
+    {
+        size = get64le(header + 8);
+        block_size = get32le(header + 16);
+        version = header[20];
+        shift = header[21];
+
+        if (block_size == 0 || block_size > CSO_MAX_READ_BLOCK_SIZE || (block_size & (block_size - 1)) != 0 || shift > 31)
+        {
+            sys_error("ERROR: unsupported block size %u or index shift %u in %s\n", block_size, shift, input);
+        }
+        if (version > 2)
+        {
+            sys_error("ERROR: unsupported version %u of %s\n", version, input);
+        }
+
+        uint64_t count = (size + block_size - 1) / block_size;
+        if (sizeof(header) + (count + 1) * sizeof(uint32_t) > input_size)
+        {
+            sys_error("ERROR: %s is too short for its index\n", input);
+        }
+        block_count = (uint32_t)count;
+
+        index = sys_realloc(NULL, (block_count + 1) * sizeof(uint32_t));
+        sys_read(file, sizeof(header), index, (block_count + 1) * sizeof(uint32_t));
+        for (uint32_t i = 0; i <= block_count; i++)
+        {
+            index[i] = get32le((const uint8_t*)(index + i));
+        }
+    }
+
+    sys_output("[*] converting %s to %s\n", input, output);
+    sys_output_progress_init(input_size);
+
+    out_begin(NULL, OUT_FORMAT_FOLDER, 0, 0, 0);
+    out_begin_file(output, 0);
+
+    cso_writer* writer = NULL;
+    if (options->format == CSO_FORMAT_ISO)
+    {
+        out_reserve(size);
+    }
+    else
+    {
+        writer = cso_begin(options, size);
+    }
+
+    uint8_t* data = sys_realloc(NULL, block_size);
+    uint8_t* compressed = format == CSO_FORMAT_ISO ? NULL : sys_realloc(NULL, 2 * block_size);
+
+    uint64_t offset = 0;
+    for (uint32_t i = 0; offset < size; i++)
+    {
+        uint32_t expected = (uint32_t)min64(block_size, size - offset);
+        uint32_t data_size;
+
+        if (format == CSO_FORMAT_ISO)
+        {
+            sys_output_progress(offset);
+            sys_read(file, offset, data, expected);
+            data_size = expected;
+        }
+        else
+        {
+            uint64_t start = (uint64_t)(index[i] & 0x7fffffff) << shift;
+            uint64_t end = (uint64_t)(index[i + 1] & 0x7fffffff) << shift;
+            if (end < start || end - start > 2 * block_size || end > input_size)
+            {
+                sys_error("ERROR: corrupted index of block %u in %s\n", i, input);
+            }
+            uint32_t compressed_size = (uint32_t)(end - start);
+
+            sys_output_progress(start);
+            sys_read(file, start, compressed, compressed_size);
+
+            // in v1 top bit marks raw block, in v2 raw block is not smaller than block size and top bit means LZ4
+            int raw = version < 2 ? (index[i] >> 31) : compressed_size >= block_size;
+            int lz4 = format == CSO_FORMAT_ZSO || (version == 2 && (index[i] >> 31));
+            if (raw)
+            {
+                data_size = min32(compressed_size, block_size);
+                memcpy(data, compressed, data_size);
+            }
+            else if (lz4)
+            {
+                data_size = lz4_decompress(compressed, compressed_size, data, block_size);
+            }
+            else
+            {
+                unsigned long destlen = block_size;
+                unsigned long sourcelen = compressed_size;
+                data_size = puff(0, data, &destlen, compressed, &sourcelen) == 0 ? (uint32_t)destlen : 0;
+            }
+
+            if (data_size < expected)
+            {
+                sys_error("ERROR: cannot decompress block %u in %s\n", i, input);
+            }
+        }
+
+        if (writer)
+        {
+            cso_write(writer, data, expected);
+        }
+        else
+        {
+            out_write(data, expected);
+        }
+        offset += expected;
+    }
+
+    if (writer)
+    {
+        cso_end(writer);
+    }
+    out_end_file();
+    out_end();
+
+    if (compressed)
+    {
+        sys_realloc(compressed, 0);
+    }
+    if (index)
+    {
+        sys_realloc(index, 0);
+    }
+    sys_realloc(data, 0);
+    sys_close(file);
+}
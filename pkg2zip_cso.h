@@ -0,0 +1,33 @@
+#pragma once
+
+#include "pkg2zip_utils.h"
+
+#define CSO_DEFAULT_BLOCK_SIZE 2048
+#define CSO_MAX_BLOCK_SIZE (64 * 1024)
+// optimal parse deflate encoder instead of tdefl
+#define CSO_MAX_LEVEL 10
+
+typedef enum {
+    CSO_FORMAT_ISO,
+    CSO_FORMAT_CSO, // deflate compressed blocks
+    CSO_FORMAT_ZSO, // LZ4 compressed blocks
+} cso_format;
+
+typedef struct {
+    cso_format format;
+    int level; // deflate level for .CSO
+    int dedup;
+    int version;
+    uint32_t block_size; // power of two, at least 2048 bytes
+} cso_options;
+
+typedef struct cso_writer cso_writer;
+
+// starts .CSO or .ZSO file in current output file for iso of this size
+// compressed data is written with out_write, header and index at beginning of file when finished
+cso_writer* cso_begin(const cso_options* options, uint64_t size);
+void cso_write(cso_writer* cso, const uint8_t* data, uint32_t size);
+void cso_end(cso_writer* cso);
+
+// converts .ISO, .CSO or .ZSO file to format from options, input format is detected from its header
+void cso_convert(const char* input, const char* output, const cso_options* options);
@@ -0,0 +1,916 @@
+#include "pkg2zip_deflate.h"
+#include "pkg2zip_sys.h"
+#include "pkg2zip_utils.h"
+
+#include <stdlib.h>
+
+// https://www.ietf.org/rfc/rfc1951.txt
+// https://github.com/google/zopfli/blob/master/src/zopfli/squeeze.c
+// https://github.com/google/zopfli/blob/master/src/zopfli/blocksplitter.c
+
+// all matches in input are found once, then cheapest path through input is searched with shortest
+// path over positions, symbol costs for next pass are taken from statistics of previous path
+// path is split where separate blocks are smaller, then every block is parsed again with its own costs
+
+#define DEFLATE_WINDOW_SIZE 32768
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_MAX_CHAIN 4096
+#define DEFLATE_MAX_PASSES 15
+
+#define DEFLATE_MAX_BLOCKS 16
+#define DEFLATE_SPLIT_SAMPLES 9
+#define DEFLATE_MIN_SPLIT 10 // symbols
+#define DEFLATE_MAX_STORED 65535
+
+// block types
+#define DEFLATE_STORED 0
+#define DEFLATE_FIXED 1
+#define DEFLATE_DYNAMIC 2
+
+#define DEFLATE_LITLEN_CODES 286
+// fixed code also has lengths for 286 and 287, which are needed for canonical codes of 9 bit literals
+#define DEFLATE_FIXED_LITLEN_CODES 288
+#define DEFLATE_DIST_CODES 30
+#define DEFLATE_CODELEN_CODES 19
+#define DEFLATE_MAX_BITS 15
+#define DEFLATE_MAX_CODELEN_BITS 7
+#define DEFLATE_END_OF_BLOCK 256
+
+static const uint16_t deflate_length_base[] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+static const uint8_t deflate_length_extra[] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+static const uint16_t deflate_dist_base[] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+};
+static const uint8_t deflate_dist_extra[] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+static const uint8_t deflate_codelen_order[] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15,
+};
+
+typedef struct {
+    uint16_t length; // 1 = literal
+    uint16_t dist;
+} deflate_match;
+
+typedef struct {
+    uint32_t litlen[DEFLATE_LITLEN_CODES];
+    uint32_t dist[DEFLATE_DIST_CODES];
+    uint64_t extra_bits; // for lengths and distances, same for any tree
+} deflate_stats;
+
+typedef struct {
+    uint8_t litlen[DEFLATE_FIXED_LITLEN_CODES];
+    uint8_t dist[DEFLATE_DIST_CODES];
+    uint32_t litlen_count;
+    uint32_t dist_count;
+
+    // code lengths of both trees are run length encoded with codelen symbols
+    uint8_t codelen[DEFLATE_CODELEN_CODES];
+    uint32_t codelen_count;
+    uint8_t runs[DEFLATE_LITLEN_CODES + DEFLATE_DIST_CODES];
+    uint8_t run_extra[DEFLATE_LITLEN_CODES + DEFLATE_DIST_CODES];
+    uint32_t run_count;
+} deflate_tree;
+
+struct deflate_optimal
+{
+    uint32_t max_size;
+
+    int32_t head[1 << DEFLATE_HASH_BITS];
+    int32_t* prev;
+
+    // for every position matches with increasing length, each with smallest distance for its length
+    uint32_t* match_start;
+    deflate_match* matches;
+    uint32_t match_count;
+    uint32_t match_allocated;
+
+    // cheapest way to reach every position, and last step of it
+    float* cost;
+    deflate_match* step;
+
+    // current path and best path found so far
+    deflate_match* path;
+    uint32_t path_count;
+    deflate_match* best;
+    uint32_t best_count;
+
+    // input position of every symbol in path that is being split, and split positions
+    uint32_t* offset;
+    uint32_t split[DEFLATE_MAX_BLOCKS];
+    uint32_t split_count;
+
+    uint8_t length_code[DEFLATE_MAX_MATCH + 1];
+    uint8_t dist_code[512];
+
+    deflate_tree fixed;
+};
+
+static uint32_t deflate_hash(const uint8_t* data)
+{
+    return ((data[0] << 10) ^ (data[1] << 5) ^ data[2]) & ((1 << DEFLATE_HASH_BITS) - 1);
+}
+
+static uint32_t deflate_get_dist_code(const deflate_optimal* d, uint32_t dist)
+{
+    return dist <= 256 ? d->dist_code[dist - 1] : d->dist_code[256 + ((dist - 1) >> 7)];
+}
+
+// log2 without libm, precision is only needed for comparing costs
+static float deflate_log2(uint32_t x)
+{
+    int bits = 0;
+    while (x >> (bits + 1))
+    {
+        bits++;
+    }
+
+    // log2(m) for m in [1, 2) from atanh series
+    float m = (float)x / (float)(1U << bits);
+    float t = (m - 1) / (m + 1);
+    float t2 = t * t;
+    float ln = 2 * t * (1 + t2 * (1.0f / 3 + t2 * (1.0f / 5 + t2 * (1.0f / 7))));
+    return bits + ln * 1.44269504f;
+}
+
+deflate_optimal* deflate_optimal_create(uint32_t max_size)
+{
+    deflate_optimal* d = sys_realloc(NULL, sizeof(*d));
+    d->max_size = max_size;
+    for (size_t i = 0; i < sizeof(d->head) / sizeof(*d->head); i++)
+    {
+        d->head[i] = -1;
+    }
+    d->prev = sys_realloc(NULL, max_size * sizeof(*d->prev));
+    d->match_start = sys_realloc(NULL, (max_size + 1) * sizeof(*d->match_start));
+    d->match_allocated = max_size;
+    d->matches = sys_realloc(NULL, d->match_allocated * sizeof(*d->matches));
+    d->cost = sys_realloc(NULL, (max_size + 1) * sizeof(*d->cost));
+    d->step = sys_realloc(NULL, (max_size + 1) * sizeof(*d->step));
+    d->path = sys_realloc(NULL, max_size * sizeof(*d->path));
+    d->best = sys_realloc(NULL, max_size * sizeof(*d->best));
+    d->offset = sys_realloc(NULL, (max_size + 1) * sizeof(*d->offset));
+
+    for (uint32_t code = 0; code < sizeof(deflate_length_base) / sizeof(*deflate_length_base); code++)
+    {
+        for (uint32_t length = deflate_length_base[code]; length < deflate_length_base[code] + (1U << deflate_length_extra[code]); length++)
+        {
+            d->length_code[length] = (uint8_t)code;
+        }
+    }
+    // 258 has its own code, although 284 with 5 extra bits could also encode it
+    d->length_code[DEFLATE_MAX_MATCH] = 28;
+
+    // first 256 distances directly, larger ones by 128
+    for (uint32_t code = 0; code < DEFLATE_DIST_CODES; code++)
+    {
+        for (uint32_t dist = deflate_dist_base[code]; dist < deflate_dist_base[code] + (1U << deflate_dist_extra[code]); dist++)
+        {
+            if (dist <= 256)
+            {
+                d->dist_code[dist - 1] = (uint8_t)code;
+            }
+            else
+            {
+                d->dist_code[256 + ((dist - 1) >> 7)] = (uint8_t)code;
+            }
+        }
+    }
+
+    // distances 30 and 31 have longest code in fixed block, so they can be left out
+    memset(&d->fixed, 0, sizeof(d->fixed));
+    for (uint32_t i = 0; i < DEFLATE_FIXED_LITLEN_CODES; i++)
+    {
+        d->fixed.litlen[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    }
+    memset(d->fixed.dist, 5, sizeof(d->fixed.dist));
+    return d;
+}
+
+void deflate_optimal_free(deflate_optimal* d)
+{
+    sys_realloc(d->prev, 0);
+    sys_realloc(d->match_start, 0);
+    sys_realloc(d->matches, 0);
+    sys_realloc(d->cost, 0);
+    sys_realloc(d->step, 0);
+    sys_realloc(d->path, 0);
+    sys_realloc(d->best, 0);
+    sys_realloc(d->offset, 0);
+    sys_realloc(d, 0);
+}
+
+static void deflate_find_matches(deflate_optimal* d, const uint8_t* input, uint32_t size)
+{
+    d->match_count = 0;
+    for (uint32_t i = 0; i < size; i++)
+    {
+        d->match_start[i] = d->match_count;
+        if (i + DEFLATE_MIN_MATCH > size)
+        {
+            continue;
+        }
+
+        const uint8_t* current = input + i;
+        uint32_t hash = deflate_hash(current);
+        uint32_t max = min32(DEFLATE_MAX_MATCH, size - i);
+        uint32_t best = DEFLATE_MIN_MATCH - 1;
+
+        // chain goes from nearest to farthest, so first match of every length has smallest distance
+        uint32_t chain = 0;
+        for (int32_t candidate = d->head[hash]; candidate >= 0 && i - candidate <= DEFLATE_WINDOW_SIZE && chain < DEFLATE_MAX_CHAIN; candidate = d->prev[candidate], chain++)
+        {
+            const uint8_t* previous = input + candidate;
+            if (previous[best] != current[best])
+            {
+                continue;
+            }
+
+            uint32_t length = 0;
+            while (length < max && previous[length] == current[length])
+            {
+                length++;
+            }
+            if (length > best)
+            {
+                if (d->match_count == d->match_allocated)
+                {
+                    d->match_allocated *= 2;
+                    d->matches = sys_realloc(d->matches, d->match_allocated * sizeof(*d->matches));
+                }
+                deflate_match* match = d->matches + d->match_count++;
+                match->length = (uint16_t)length;
+                match->dist = (uint16_t)(i - candidate);
+
+                best = length;
+                if (best == max)
+                {
+                    break;
+                }
+            }
+        }
+
+        d->prev[i] = d->head[hash];
+        d->head[hash] = (int32_t)i;
+    }
+    d->match_start[size] = d->match_count;
+
+    // only used heads are cleared for next block
+    for (uint32_t i = 0; i + DEFLATE_MIN_MATCH <= size; i++)
+    {
+        d->head[deflate_hash(input + i)] = -1;
+    }
+}
+
+// symbol costs in bits, entropy of symbol in statistics
+static void deflate_costs(const uint32_t* freq, uint32_t count, float* cost)
+{
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        total += freq[i];
+    }
+
+    // unused symbols cost same as symbol used once
+    float log_total = deflate_log2(total ? total : count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        cost[i] = total && freq[i] ? log_total - deflate_log2(freq[i]) : log_total;
+    }
+}
+
+// finds cheapest path from one input position to other with current symbol costs
+static void deflate_parse(deflate_optimal* d, const uint8_t* input, uint32_t from, uint32_t to, const float* litlen_cost, const float* dist_cost)
+{
+    float length_cost[DEFLATE_MAX_MATCH + 1];
+    for (uint32_t length = DEFLATE_MIN_MATCH; length <= DEFLATE_MAX_MATCH; length++)
+    {
+        uint32_t code = d->length_code[length];
+        length_cost[length] = litlen_cost[257 + code] + deflate_length_extra[code];
+    }
+
+    d->cost[from] = 0;
+    for (uint32_t i = from + 1; i <= to; i++)
+    {
+        d->cost[i] = 1e30f;
+    }
+
+    for (uint32_t i = from; i < to; i++)
+    {
+        float base = d->cost[i];
+
+        float cost = base + litlen_cost[input[i]];
+        if (cost < d->cost[i + 1])
+        {
+            d->cost[i + 1] = cost;
+            d->step[i + 1].length = 1;
+            d->step[i + 1].dist = 0;
+        }
+
+        // matches cannot go past end of block
+        uint32_t length = DEFLATE_MIN_MATCH;
+        uint32_t max = to - i;
+        for (uint32_t m = d->match_start[i]; m < d->match_start[i + 1] && length <= max; m++)
+        {
+            const deflate_match* match = d->matches + m;
+            uint32_t code = deflate_get_dist_code(d, match->dist);
+            float match_base = base + dist_cost[code] + deflate_dist_extra[code];
+
+            for (; length <= match->length && length <= max; length++)
+            {
+                cost = match_base + length_cost[length];
+                if (cost < d->cost[i + length])
+                {
+                    d->cost[i + length] = cost;
+                    d->step[i + length].length = (uint16_t)length;
+                    d->step[i + length].dist = match->dist;
+                }
+            }
+        }
+    }
+
+    // path is collected backwards from end of block
+    uint32_t count = 0;
+    for (uint32_t pos = to; pos != from; pos -= d->step[pos].length)
+    {
+        d->path[count++] = d->step[pos];
+    }
+    for (uint32_t i = 0; i < count / 2; i++)
+    {
+        deflate_match temp = d->path[i];
+        d->path[i] = d->path[count - 1 - i];
+        d->path[count - 1 - i] = temp;
+    }
+    d->path_count = count;
+}
+
+// statistics of symbols in path that starts at input position
+static void deflate_count(const deflate_optimal* d, const uint8_t* input, uint32_t pos, const deflate_match* path, uint32_t count, deflate_stats* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const deflate_match* match = path + i;
+        if (match->dist == 0)
+        {
+            stats->litlen[input[pos]]++;
+        }
+        else
+        {
+            uint32_t length_code = d->length_code[match->length];
+            uint32_t dist_code = deflate_get_dist_code(d, match->dist);
+            stats->litlen[257 + length_code]++;
+            stats->dist[dist_code]++;
+            stats->extra_bits += deflate_length_extra[length_code] + deflate_dist_extra[dist_code];
+        }
+        pos += match->length;
+    }
+    stats->litlen[DEFLATE_END_OF_BLOCK]++;
+}
+
+static int deflate_compare(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// huffman code lengths limited to max_bits, at least two symbols get code so code is always complete
+static void deflate_huffman(const uint32_t* freq, uint32_t count, uint32_t max_bits, uint8_t* lengths)
+{
+    // frequency in high bits, symbol in low bits, so sorting gives stable order
+    uint64_t leaves[DEFLATE_LITLEN_CODES];
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (freq[i])
+        {
+            leaves[used++] = ((uint64_t)freq[i] << 16) | i;
+        }
+    }
+
+    memset(lengths, 0, count);
+    if (used < 2)
+    {
+        uint32_t first = used ? (uint32_t)(leaves[0] & 0xffff) : 0;
+        lengths[first] = 1;
+        lengths[first == 0 ? 1 : 0] = 1;
+        return;
+    }
+
+    qsort(leaves, used, sizeof(*leaves), deflate_compare);
+
+    // sorted leaves and created nodes are two queues with increasing weights
+    uint64_t weight[2 * DEFLATE_LITLEN_CODES];
+    uint16_t parent[2 * DEFLATE_LITLEN_CODES];
+    for (uint32_t i = 0; i < used; i++)
+    {
+        weight[i] = leaves[i] >> 16;
+    }
+    uint32_t leaf = 0;
+    uint32_t node = used;
+    for (uint32_t next = used; next < 2 * used - 1; next++)
+    {
+        weight[next] = 0;
+        for (int child = 0; child < 2; child++)
+        {
+            uint32_t pick = leaf < used && (node == next || weight[leaf] <= weight[node]) ? leaf++ : node++;
+            parent[pick] = (uint16_t)next;
+            weight[next] += weight[pick];
+        }
+    }
+
+    uint16_t depth[2 * DEFLATE_LITLEN_CODES];
+    uint32_t length_count[DEFLATE_LITLEN_CODES + 1] = { 0 };
+    depth[2 * used - 2] = 0;
+    for (uint32_t i = 2 * used - 2; i-- != 0; )
+    {
+        depth[i] = depth[parent[i]] + 1;
+    }
+    for (uint32_t i = 0; i < used; i++)
+    {
+        length_count[depth[i] > max_bits ? max_bits : depth[i]]++;
+    }
+
+    // too long codes are shortened, then codes are moved one level down until lengths are valid again
+    uint32_t total = 0;
+    for (uint32_t bits = 1; bits <= max_bits; bits++)
+    {
+        total += length_count[bits] << (max_bits - bits);
+    }
+    while (total > (1U << max_bits))
+    {
+        length_count[max_bits]--;
+        for (uint32_t bits = max_bits - 1; bits != 0; bits--)
+        {
+            if (length_count[bits])
+            {
+                length_count[bits]--;
+                length_count[bits + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+
+    // most frequent symbols get shortest codes
+    uint32_t i = used;
+    for (uint32_t bits = 1; bits <= max_bits; bits++)
+    {
+        for (uint32_t n = 0; n < length_count[bits]; n++)
+        {
+            lengths[leaves[--i] & 0xffff] = (uint8_t)bits;
+        }
+    }
+}
+
+// canonical codes, bits are reversed because deflate writes codes starting from most significant bit
+static void deflate_codes(const uint8_t* lengths, uint32_t count, uint16_t* codes)
+{
+    uint32_t length_count[DEFLATE_MAX_BITS + 1] = { 0 };
+    for (uint32_t i = 0; i < count; i++)
+    {
+        length_count[lengths[i]]++;
+    }
+    length_count[0] = 0;
+
+    uint32_t next[DEFLATE_MAX_BITS + 1];
+    uint32_t code = 0;
+    for (uint32_t bits = 1; bits <= DEFLATE_MAX_BITS; bits++)
+    {
+        code = (code + length_count[bits - 1]) << 1;
+        next[bits] = code;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t bits = lengths[i];
+        if (bits)
+        {
+            uint32_t value = next[bits]++;
+            uint32_t reversed = 0;
+            for (uint32_t b = 0; b < bits; b++)
+            {
+                reversed = (reversed << 1) | ((value >> b) & 1);
+            }
+            codes[i] = (uint16_t)reversed;
+        }
+    }
+}
+
+static void deflate_tree_run(deflate_tree* tree, uint32_t symbol, uint32_t extra)
+{
+    tree->runs[tree->run_count] = (uint8_t)symbol;
+    tree->run_extra[tree->run_count] = (uint8_t)extra;
+    tree->run_count++;
+}
+
+// builds dynamic trees for statistics, returns size of block header in bits
+static uint64_t deflate_tree_build(deflate_tree* tree, const deflate_stats* stats)
+{
+    memset(tree->litlen, 0, sizeof(tree->litlen));
+    deflate_huffman(stats->litlen, DEFLATE_LITLEN_CODES, DEFLATE_MAX_BITS, tree->litlen);
+    deflate_huffman(stats->dist, DEFLATE_DIST_CODES, DEFLATE_MAX_BITS, tree->dist);
+
+    tree->litlen_count = DEFLATE_LITLEN_CODES;
+    while (tree->litlen_count > 257 && tree->litlen[tree->litlen_count - 1] == 0)
+    {
+        tree->litlen_count--;
+    }
+    tree->dist_count = DEFLATE_DIST_CODES;
+    while (tree->dist_count > 1 && tree->dist[tree->dist_count - 1] == 0)
+    {
+        tree->dist_count--;
+    }
+
+    // both trees are one sequence of lengths, runs can cross from one to other
+    uint8_t lengths[DEFLATE_LITLEN_CODES + DEFLATE_DIST_CODES];
+    uint32_t total = tree->litlen_count + tree->dist_count;
+    memcpy(lengths, tree->litlen, tree->litlen_count);
+    memcpy(lengths + tree->litlen_count, tree->dist, tree->dist_count);
+
+    tree->run_count = 0;
+    for (uint32_t i = 0; i < total; )
+    {
+        uint32_t length = lengths[i];
+        uint32_t run = 1;
+        while (i + run < total && lengths[i + run] == length)
+        {
+            run++;
+        }
+
+        if (length == 0 && run >= 3)
+        {
+            uint32_t chunk = min32(run, 138);
+            deflate_tree_run(tree, chunk >= 11 ? 18 : 17, chunk - (chunk >= 11 ? 11 : 3));
+            i += chunk;
+        }
+        else if (length != 0 && i != 0 && lengths[i - 1] == length && run >= 3)
+        {
+            uint32_t chunk = min32(run, 6);
+            deflate_tree_run(tree, 16, chunk - 3);
+            i += chunk;
+        }
+        else
+        {
+            deflate_tree_run(tree, length, 0);
+            i++;
+        }
+    }
+
+    uint32_t freq[DEFLATE_CODELEN_CODES] = { 0 };
+    for (uint32_t i = 0; i < tree->run_count; i++)
+    {
+        freq[tree->runs[i]]++;
+    }
+    deflate_huffman(freq, DEFLATE_CODELEN_CODES, DEFLATE_MAX_CODELEN_BITS, tree->codelen);
+
+    tree->codelen_count = DEFLATE_CODELEN_CODES;
+    while (tree->codelen_count > 4 && tree->codelen[deflate_codelen_order[tree->codelen_count - 1]] == 0)
+    {
+        tree->codelen_count--;
+    }
+
+    uint64_t bits = 5 + 5 + 4 + 3 * tree->codelen_count;
+    for (uint32_t i = 0; i < DEFLATE_CODELEN_CODES; i++)
+    {
+        bits += (uint64_t)freq[i] * tree->codelen[i];
+    }
+    bits += 2 * freq[16] + 3 * freq[17] + 7 * freq[18];
+    return bits;
+}
+
+// size of block data with these trees, without header
+static uint64_t deflate_data_bits(const deflate_stats* stats, const deflate_tree* tree)
+{
+    uint64_t bits = stats->extra_bits;
+    for (uint32_t i = 0; i < DEFLATE_LITLEN_CODES; i++)
+    {
+        bits += (uint64_t)stats->litlen[i] * tree->litlen[i];
+    }
+    for (uint32_t i = 0; i < DEFLATE_DIST_CODES; i++)
+    {
+        bits += (uint64_t)stats->dist[i] * tree->dist[i];
+    }
+    return bits;
+}
+
+// smallest size of compressed block in bits, type tells if it is fixed or dynamic
+static uint64_t deflate_block_bits(const deflate_optimal* d, const deflate_stats* stats, deflate_tree* tree, int* type)
+{
+    uint64_t dynamic_bits = 3 + deflate_tree_build(tree, stats) + deflate_data_bits(stats, tree);
+    uint64_t fixed_bits = 3 + deflate_data_bits(stats, &d->fixed);
+
+    *type = fixed_bits <= dynamic_bits ? DEFLATE_FIXED : DEFLATE_DYNAMIC;
+    return fixed_bits <= dynamic_bits ? fixed_bits : dynamic_bits;
+}
+
+// approximate, padding to byte boundary depends on previous block
+static uint64_t deflate_stored_bits(uint32_t size)
+{
+    uint32_t count = size == 0 ? 1 : (size + DEFLATE_MAX_STORED - 1) / DEFLATE_MAX_STORED;
+    return count * (3 + 5 + 32) + 8 * (uint64_t)size;
+}
+
+// best path for block is left in d->best, returns its size in bits
+static uint64_t deflate_optimize(deflate_optimal* d, const uint8_t* input, uint32_t from, uint32_t to, deflate_tree* best_tree, int* best_type)
+{
+    // first pass uses costs of fixed codes, because there are no statistics yet
+    float litlen_cost[DEFLATE_LITLEN_CODES];
+    float dist_cost[DEFLATE_DIST_CODES];
+    for (uint32_t i = 0; i < DEFLATE_LITLEN_CODES; i++)
+    {
+        litlen_cost[i] = d->fixed.litlen[i];
+    }
+    for (uint32_t i = 0; i < DEFLATE_DIST_CODES; i++)
+    {
+        dist_cost[i] = d->fixed.dist[i];
+    }
+
+    uint64_t best_bits = UINT64_MAX;
+    for (uint32_t pass = 0; pass < DEFLATE_MAX_PASSES; pass++)
+    {
+        deflate_parse(d, input, from, to, litlen_cost, dist_cost);
+
+        deflate_stats stats;
+        deflate_count(d, input, from, d->path, d->path_count, &stats);
+
+        deflate_tree tree;
+        int type;
+        uint64_t bits = deflate_block_bits(d, &stats, &tree, &type);
+
+        // statistics stop changing when path does not get better
+        if (bits >= best_bits)
+        {
+            break;
+        }
+        best_bits = bits;
+        *best_type = type;
+        *best_tree = tree;
+
+        deflate_match* temp = d->best;
+        d->best = d->path;
+        d->path = temp;
+        d->best_count = d->path_count;
+
+        deflate_costs(stats.litlen, DEFLATE_LITLEN_CODES, litlen_cost);
+        deflate_costs(stats.dist, DEFLATE_DIST_CODES, dist_cost);
+    }
+
+    uint64_t stored_bits = deflate_stored_bits(to - from);
+    if (stored_bits < best_bits)
+    {
+        *best_type = DEFLATE_STORED;
+        return stored_bits;
+    }
+    return best_bits;
+}
+
+// size of block for symbols from start to end in path that is being split
+static uint64_t deflate_split_bits(const deflate_optimal* d, const uint8_t* input, uint32_t start, uint32_t end)
+{
+    deflate_stats stats;
+    deflate_count(d, input, d->offset[start], d->best + start, end - start, &stats);
+
+    deflate_tree tree;
+    int type;
+    uint64_t bits = deflate_block_bits(d, &stats, &tree, &type);
+    uint64_t stored_bits = deflate_stored_bits(d->offset[end] - d->offset[start]);
+    return stored_bits < bits ? stored_bits : bits;
+}
+
+// splits symbols from start to end in two where sum of both block sizes is smallest, then same for both halves
+static void deflate_split(deflate_optimal* d, const uint8_t* input, uint32_t start, uint32_t end)
+{
+    if (end - start < 2 * DEFLATE_MIN_SPLIT || d->split_count == DEFLATE_MAX_BLOCKS - 1)
+    {
+        return;
+    }
+
+    // size does not change smoothly, so instead of checking every split only samples are checked and
+    // range is narrowed around best sample, like zopfli does it
+    uint32_t low = start + DEFLATE_MIN_SPLIT;
+    uint32_t high = end - DEFLATE_MIN_SPLIT;
+    uint32_t best = low;
+    uint64_t best_bits = UINT64_MAX;
+    for (;;)
+    {
+        uint32_t samples = min32(DEFLATE_SPLIT_SAMPLES, high - low + 1);
+        uint32_t best_sample = 0;
+        uint32_t positions[DEFLATE_SPLIT_SAMPLES];
+        for (uint32_t i = 0; i < samples; i++)
+        {
+            uint32_t split = samples == high - low + 1 ? low + i : low + (uint32_t)((uint64_t)(high - low) * i / (samples - 1));
+            positions[i] = split;
+
+            uint64_t bits = deflate_split_bits(d, input, start, split) + deflate_split_bits(d, input, split, end);
+            if (bits < best_bits)
+            {
+                best_bits = bits;
+                best = split;
+                best_sample = i;
+            }
+        }
+        if (samples == high - low + 1)
+        {
+            break;
+        }
+
+        uint32_t next_low = best_sample == 0 ? low : positions[best_sample - 1];
+        uint32_t next_high = best_sample == samples - 1 ? high : positions[best_sample + 1];
+        if (next_high - next_low >= high - low)
+        {
+            break;
+        }
+        low = next_low;
+        high = next_high;
+    }
+
+    if (best_bits >= deflate_split_bits(d, input, start, end))
+    {
+        return;
+    }
+
+    // splits are collected in increasing order
+    deflate_split(d, input, start, best);
+    if (d->split_count < DEFLATE_MAX_BLOCKS - 1)
+    {
+        d->split[d->split_count++] = d->offset[best];
+    }
+    deflate_split(d, input, best, end);
+}
+
+typedef struct {
+    uint8_t* output;
+    uint32_t capacity;
+    uint32_t size;
+    int overflow;
+    uint64_t bits;
+    uint32_t count;
+} deflate_writer;
+
+static void deflate_put(deflate_writer* w, uint32_t value, uint32_t count)
+{
+    w->bits |= (uint64_t)value << w->count;
+    w->count += count;
+    while (w->count >= 8)
+    {
+        if (w->size == w->capacity)
+        {
+            w->overflow = 1;
+        }
+        else
+        {
+            w->output[w->size++] = (uint8_t)w->bits;
+        }
+        w->bits >>= 8;
+        w->count -= 8;
+    }
+}
+
+static void deflate_write_stored(deflate_writer* w, const uint8_t* input, uint32_t size, int last)
+{
+    // stored block has 16-bit length, so larger ones are written as several blocks
+    do
+    {
+        uint32_t chunk = min32(size, DEFLATE_MAX_STORED);
+        deflate_put(w, last && chunk == size, 1);
+        deflate_put(w, DEFLATE_STORED, 2);
+        if (w->count != 0)
+        {
+            deflate_put(w, 0, 8 - w->count);
+        }
+        deflate_put(w, chunk, 16);
+        deflate_put(w, chunk ^ 0xffff, 16);
+        for (uint32_t i = 0; i < chunk; i++)
+        {
+            deflate_put(w, input[i], 8);
+        }
+        input += chunk;
+        size -= chunk;
+    }
+    while (size != 0);
+}
+
+static void deflate_write(const deflate_optimal* d, deflate_writer* w, const uint8_t* input, const deflate_tree* tree, int type, int last)
+{
+    deflate_put(w, last, 1);
+    deflate_put(w, type, 2);
+
+    if (type == DEFLATE_DYNAMIC)
+    {
+        uint16_t codes[DEFLATE_CODELEN_CODES];
+        deflate_codes(tree->codelen, DEFLATE_CODELEN_CODES, codes);
+
+        deflate_put(w, tree->litlen_count - 257, 5);
+        deflate_put(w, tree->dist_count - 1, 5);
+        deflate_put(w, tree->codelen_count - 4, 4);
+        for (uint32_t i = 0; i < tree->codelen_count; i++)
+        {
+            deflate_put(w, tree->codelen[deflate_codelen_order[i]], 3);
+        }
+        for (uint32_t i = 0; i < tree->run_count; i++)
+        {
+            uint32_t symbol = tree->runs[i];
+            deflate_put(w, codes[symbol], tree->codelen[symbol]);
+            if (symbol >= 16)
+            {
+                deflate_put(w, tree->run_extra[i], symbol == 16 ? 2 : symbol == 17 ? 3 : 7);
+            }
+        }
+    }
+
+    uint16_t litlen_codes[DEFLATE_FIXED_LITLEN_CODES];
+    uint16_t dist_codes[DEFLATE_DIST_CODES];
+    deflate_codes(tree->litlen, DEFLATE_FIXED_LITLEN_CODES, litlen_codes);
+    deflate_codes(tree->dist, DEFLATE_DIST_CODES, dist_codes);
+
+    uint32_t pos = 0;
+    for (uint32_t i = 0; i < d->best_count; i++)
+    {
+        const deflate_match* match = d->best + i;
+        if (match->dist == 0)
+        {
+            uint32_t literal = input[pos];
+            deflate_put(w, litlen_codes[literal], tree->litlen[literal]);
+        }
+        else
+        {
+            uint32_t length_code = d->length_code[match->length];
+            deflate_put(w, litlen_codes[257 + length_code], tree->litlen[257 + length_code]);
+            deflate_put(w, match->length - deflate_length_base[length_code], deflate_length_extra[length_code]);
+
+            uint32_t dist_code = deflate_get_dist_code(d, match->dist);
+            deflate_put(w, dist_codes[dist_code], tree->dist[dist_code]);
+            deflate_put(w, match->dist - deflate_dist_base[dist_code], deflate_dist_extra[dist_code]);
+        }
+        pos += match->length;
+    }
+    deflate_put(w, litlen_codes[DEFLATE_END_OF_BLOCK], tree->litlen[DEFLATE_END_OF_BLOCK]);
+}
+
+uint32_t deflate_optimal_compress(deflate_optimal* d, const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity)
+{
+    if (size > d->max_size)
+    {
+        return 0;
+    }
+
+    deflate_find_matches(d, input, size);
+
+    deflate_tree tree;
+    int type;
+    deflate_optimize(d, input, 0, size, &tree, &type);
+
+    uint32_t pos = 0;
+    for (uint32_t i = 0; i < d->best_count; i++)
+    {
+        d->offset[i] = pos;
+        pos += d->best[i].length;
+    }
+    d->offset[d->best_count] = pos;
+
+    d->split_count = 0;
+    deflate_split(d, input, 0, d->best_count);
+
+    deflate_writer w = { output, capacity, 0, 0, 0, 0 };
+    for (uint32_t i = 0; i <= d->split_count; i++)
+    {
+        uint32_t from = i == 0 ? 0 : d->split[i - 1];
+        uint32_t to = i == d->split_count ? size : d->split[i];
+        int last = i == d->split_count;
+
+        // without splits path for whole input is already known
+        if (d->split_count != 0)
+        {
+            deflate_optimize(d, input, from, to, &tree, &type);
+        }
+
+        if (type == DEFLATE_STORED)
+        {
+            deflate_write_stored(&w, input + from, to - from, last);
+        }
+        else
+        {
+            deflate_write(d, &w, input + from, type == DEFLATE_FIXED ? &d->fixed : &tree, type, last);
+        }
+        if (w.overflow)
+        {
+            return 0;
+        }
+    }
+
+    if (w.count != 0)
+    {
+        deflate_put(&w, 0, 8 - w.count);
+    }
+    return w.overflow ? 0 : w.size;
+}
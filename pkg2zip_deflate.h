@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef struct deflate_optimal deflate_optimal;
+
+// state has buffers for inputs up to max_size bytes, it is too large for stack
+deflate_optimal* deflate_optimal_create(uint32_t max_size);
+void deflate_optimal_free(deflate_optimal* d);
+
+// compresses input into raw deflate stream of single block with optimal parsing, like zopfli does it
+// much slower than tdefl, but output is smaller and can be decompressed by any inflate
+// returns 0 if compressed data does not fit in output
+uint32_t deflate_optimal_compress(deflate_optimal* d, const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity);
@@ -0,0 +1,663 @@
+#include "pkg2zip_http.h"
+#include "pkg2zip_sys.h"
+#include "pkg2zip_utils.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// size of buffer for response header
+#define HTTP_RECV_SIZE (16 * 1024)
+
+// small reads are coalesced into bigger requests, size grows while reads are sequential
+#define HTTP_WINDOW_MIN (64 * 1024)
+#define HTTP_WINDOW_MAX (8 * 1024 * 1024)
+
+#define HTTP_MAX_REDIRECTS 5
+
+struct http_data
+{
+    char host[256];
+    char port[8];
+    char path[2048];
+
+    sys_socket sock;
+    int reused;
+
+    uint64_t size;
+    char* error;
+
+    uint8_t recv[HTTP_RECV_SIZE];
+    uint32_t recv_pos;
+    uint32_t recv_size;
+
+    uint8_t* window;
+    uint64_t window_offset;
+    uint32_t window_size;
+    uint32_t window_next;
+    uint32_t window_allocated;
+};
+
+// http_request reports errors to its caller in error buffer, other requests stop the program
+static int http_fail(http h, const char* msg, ...)
+{
+    char buffer[1024];
+    char* error = h->error ? h->error : buffer;
+
+    va_list arg;
+    va_start(arg, msg);
+    vsnprintf(error, h->error ? HTTP_ERROR_SIZE : sizeof(buffer), msg, arg);
+    va_end(arg);
+
+    if (h->error == NULL)
+    {
+        sys_error("ERROR: %s\n", buffer);
+    }
+    return 0;
+}
+
+static int http_starts_with(const char* str, const char* prefix)
+{
+    size_t len = strlen(prefix);
+    for (size_t i = 0; i < len; i++)
+    {
+        char ch = str[i];
+        if (ch >= 'A' && ch <= 'Z')
+        {
+            ch += 'a' - 'A';
+        }
+        if (ch != prefix[i])
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int http_is_url(const char* name)
+{
+    return http_starts_with(name, "http://") || http_starts_with(name, "https://");
+}
+
+// returns 0 if url is not valid
+static int http_parse_url(http h, const char* url)
+{
+    if (!http_starts_with(url, "http://"))
+    {
+        return http_fail(h, "only http:// urls are supported");
+    }
+
+    const char* host = url + 7;
+    const char* path = strchr(host, '/');
+    size_t host_len = path ? (size_t)(path - host) : strlen(host);
+
+    // ipv6 address is inside brackets
+    const char* port = NULL;
+    if (host_len != 0 && host[0] == '[')
+    {
+        const char* end = memchr(host, ']', host_len);
+        if (end && end + 1 < host + host_len && end[1] == ':')
+        {
+            port = end + 2;
+        }
+        if (end == NULL || (size_t)(end - host - 1) >= sizeof(h->host))
+        {
+            return http_fail(h, "invalid url '%s'", url);
+        }
+        memcpy(h->host, host + 1, end - host - 1);
+        h->host[end - host - 1] = 0;
+    }
+    else
+    {
+        port = memchr(host, ':', host_len);
+        size_t name_len = port ? (size_t)(port - host) : host_len;
+        if (name_len == 0 || name_len >= sizeof(h->host))
+        {
+            return http_fail(h, "invalid url '%s'", url);
+        }
+        memcpy(h->host, host, name_len);
+        h->host[name_len] = 0;
+        if (port)
+        {
+            port++;
+        }
+    }
+
+    if (port)
+    {
+        size_t port_len = host + host_len - port;
+        if (port_len == 0 || port_len >= sizeof(h->port))
+        {
+            return http_fail(h, "invalid url '%s'", url);
+        }
+        memcpy(h->port, port, port_len);
+        h->port[port_len] = 0;
+    }
+    else
+    {
+        strcpy(h->port, "80");
+    }
+
+    if (path)
+    {
+        if (strlen(path) >= sizeof(h->path))
+        {
+            return http_fail(h, "url is too long");
+        }
+        strcpy(h->path, path);
+    }
+    else
+    {
+        strcpy(h->path, "/");
+    }
+    return 1;
+}
+
+static void http_disconnect(http h)
+{
+    if (h->sock)
+    {
+        sys_disconnect(h->sock);
+        h->sock = NULL;
+    }
+    h->recv_pos = h->recv_size = 0;
+}
+
+// returns 0 if connection is closed
+static int http_recv_more(http h)
+{
+    if (h->recv_pos != 0)
+    {
+        memmove(h->recv, h->recv + h->recv_pos, h->recv_size - h->recv_pos);
+        h->recv_size -= h->recv_pos;
+        h->recv_pos = 0;
+    }
+    if (h->recv_size == sizeof(h->recv))
+    {
+        return http_fail(h, "http response header is too large");
+    }
+
+    int got = sys_recv(h->sock, h->recv + h->recv_size, sizeof(h->recv) - h->recv_size);
+    if (got <= 0)
+    {
+        return 0;
+    }
+    h->recv_size += (uint32_t)got;
+    return 1;
+}
+
+// returns value of header or NULL, header names are case insensitive
+static const char* http_header(const char* headers, const char* name)
+{
+    size_t len = strlen(name);
+    for (const char* line = headers; line; line = strchr(line, '\n'))
+    {
+        line++;
+        if (http_starts_with(line, name) && line[len] == ':')
+        {
+            line += len + 1;
+            while (*line == ' ' || *line == '\t')
+            {
+                line++;
+            }
+            return line;
+        }
+    }
+    return NULL;
+}
+
+typedef struct {
+    uint32_t status;
+    int close;
+    int chunked;
+    uint64_t first;
+    uint64_t last;
+    uint64_t total;
+    char location[2048];
+    char etag[128];
+} http_response;
+
+// returns 0 if connection was closed before full header was received
+static int http_recv_header(http h, http_response* resp)
+{
+    char* headers;
+    char* end;
+    for (;;)
+    {
+        headers = (char*)h->recv + h->recv_pos;
+        end = NULL;
+        for (uint32_t i = h->recv_pos; i + 4 <= h->recv_size; i++)
+        {
+            if (memcmp(h->recv + i, "\r\n\r\n", 4) == 0)
+            {
+                end = (char*)h->recv + i;
+                break;
+            }
+        }
+        if (end)
+        {
+            break;
+        }
+        if (!http_recv_more(h))
+        {
+            return 0;
+        }
+    }
+
+    end[2] = 0;
+    h->recv_pos = (uint32_t)((uint8_t*)end + 4 - h->recv);
+
+    unsigned major, minor, status;
+    if (sscanf(headers, "HTTP/%u.%u %u", &major, &minor, &status) != 3)
+    {
+        return http_fail(h, "invalid http response");
+    }
+    resp->status = status;
+
+    const char* connection = http_header(headers, "connection");
+    resp->close = (major == 1 && minor == 0) || (connection && http_starts_with(connection, "close"));
+
+    const char* encoding = http_header(headers, "transfer-encoding");
+    resp->chunked = encoding && http_starts_with(encoding, "chunked");
+    if (encoding && !resp->chunked && !http_starts_with(encoding, "identity"))
+    {
+        return http_fail(h, "http transfer encoding is not supported");
+    }
+
+    resp->etag[0] = 0;
+    const char* etag = http_header(headers, "etag");
+    if (etag)
+    {
+        size_t len = strcspn(etag, "\r\n");
+        if (len >= sizeof(resp->etag))
+        {
+            return http_fail(h, "http etag is too long");
+        }
+        memcpy(resp->etag, etag, len);
+        resp->etag[len] = 0;
+    }
+
+    resp->location[0] = 0;
+    const char* location = http_header(headers, "location");
+    if (location)
+    {
+        size_t len = strcspn(location, "\r\n");
+        if (len >= sizeof(resp->location))
+        {
+            return http_fail(h, "http redirect url is too long");
+        }
+        memcpy(resp->location, location, len);
+        resp->location[len] = 0;
+    }
+
+    const char* range = http_header(headers, "content-range");
+    if (resp->chunked)
+    {
+        resp->first = resp->last = resp->total = 0;
+    }
+    else if (status == 206)
+    {
+        unsigned long long first, last, total;
+        if (range == NULL || sscanf(range, "bytes %llu-%llu/%llu", &first, &last, &total) != 3 || first > last || last >= total)
+        {
+            return http_fail(h, "invalid content range in http response");
+        }
+        resp->first = first;
+        resp->last = last;
+        resp->total = total;
+    }
+    else
+    {
+        const char* length = http_header(headers, "content-length");
+        unsigned long long value;
+        if (length == NULL || sscanf(length, "%llu", &value) != 1)
+        {
+            // without length body ends only when connection is closed
+            resp->close = 1;
+            value = 0;
+        }
+        resp->first = 0;
+        resp->last = value - 1;
+        resp->total = value;
+    }
+
+    return 1;
+}
+
+static int http_recv_body(http h, uint8_t* buffer, uint64_t size)
+{
+    uint32_t available = (uint32_t)min64(h->recv_size - h->recv_pos, size);
+    memcpy(buffer, h->recv + h->recv_pos, available);
+    h->recv_pos += available;
+    buffer += available;
+    size -= available;
+
+    while (size != 0)
+    {
+        int got = sys_recv(h->sock, buffer, (uint32_t)min64(size, 1U << 30));
+        if (got <= 0)
+        {
+            return 0;
+        }
+        buffer += got;
+        size -= (uint32_t)got;
+    }
+    return 1;
+}
+
+// requests [offset, offset+size) range, server can return less only if it reaches end of file
+static uint32_t http_fetch(http h, uint64_t offset, void* buffer, uint32_t size)
+{
+    uint32_t redirects = 0;
+    for (;;)
+    {
+        if (h->sock == NULL)
+        {
+            h->sock = sys_connect(h->host, h->port);
+            if (h->sock == NULL)
+            {
+                sys_error("ERROR: cannot connect to '%s' host\n", h->host);
+            }
+            h->reused = 0;
+        }
+
+        char request[4096];
+        int length = snprintf(request, sizeof(request),
+            "GET %s HTTP/1.1\r\n"
+            "Host: %s%s%s\r\n"
+            "Range: bytes=%llu-%llu\r\n"
+            "User-Agent: pkg2zip\r\n"
+            "Connection: keep-alive\r\n"
+            "\r\n",
+            h->path, h->host, strcmp(h->port, "80") == 0 ? "" : ":", strcmp(h->port, "80") == 0 ? "" : h->port,
+            (unsigned long long)offset, (unsigned long long)(offset + size - 1));
+
+        http_response resp;
+        if (!sys_send(h->sock, request, length) || !http_recv_header(h, &resp))
+        {
+            // server may close idle keep-alive connection, so retry once with new one
+            int reused = h->reused;
+            http_disconnect(h);
+            if (reused)
+            {
+                continue;
+            }
+            sys_error("ERROR: connection to '%s' host failed\n", h->host);
+        }
+
+        if (resp.status == 301 || resp.status == 302 || resp.status == 303 || resp.status == 307 || resp.status == 308)
+        {
+            if (++redirects > HTTP_MAX_REDIRECTS || resp.location[0] == 0)
+            {
+                sys_error("ERROR: too many http redirects\n");
+            }
+            http_disconnect(h);
+            if (resp.location[0] == '/')
+            {
+                snprintf(h->path, sizeof(h->path), "%s", resp.location);
+            }
+            else
+            {
+                http_parse_url(h, resp.location);
+            }
+            continue;
+        }
+        if (resp.status == 200)
+        {
+            sys_error("ERROR: http server does not support range requests\n");
+        }
+        if (resp.chunked)
+        {
+            sys_error("ERROR: http transfer encoding is not supported\n");
+        }
+        if (resp.status != 206)
+        {
+            sys_error("ERROR: http server returned status %u\n", resp.status);
+        }
+
+        uint64_t received = resp.last - resp.first + 1;
+        if (resp.first != offset || received > size || (received != size && resp.last + 1 != resp.total))
+        {
+            sys_error("ERROR: http server returned wrong range\n");
+        }
+        if (h->size != 0 && resp.total != h->size)
+        {
+            sys_error("ERROR: file on http server has changed\n");
+        }
+        h->size = resp.total;
+
+        if (!http_recv_body(h, buffer, received))
+        {
+            sys_error("ERROR: connection to '%s' host failed\n", h->host);
+        }
+
+        if (resp.close)
+        {
+            http_disconnect(h);
+        }
+        else
+        {
+            h->reused = 1;
+        }
+        return (uint32_t)received;
+    }
+}
+
+// consumes size bytes of response body, beginning of it is stored in buffer
+static int http_recv_store(http h, uint64_t size, char* buffer, uint32_t capacity, uint32_t* stored)
+{
+    while (size != 0)
+    {
+        if (h->recv_pos == h->recv_size && !http_recv_more(h))
+        {
+            return 0;
+        }
+        uint32_t available = (uint32_t)min64(h->recv_size - h->recv_pos, size);
+        uint32_t copy = min32(available, capacity - *stored);
+        memcpy(buffer + *stored, h->recv + h->recv_pos, copy);
+        *stored += copy;
+        h->recv_pos += available;
+        size -= available;
+    }
+    return 1;
+}
+
+static int http_recv_line(http h, char* line, uint32_t size)
+{
+    for (;;)
+    {
+        for (uint32_t i = h->recv_pos; i + 2 <= h->recv_size; i++)
+        {
+            if (h->recv[i] == '\r' && h->recv[i + 1] == '\n')
+            {
+                uint32_t length = min32(i - h->recv_pos, size - 1);
+                memcpy(line, h->recv + h->recv_pos, length);
+                line[length] = 0;
+                h->recv_pos = i + 2;
+                return 1;
+            }
+        }
+        if (!http_recv_more(h))
+        {
+            return 0;
+        }
+    }
+}
+
+static int http_recv_reply(http h, const http_response* resp, char* buffer, uint32_t size)
+{
+    uint32_t stored = 0;
+    uint32_t capacity = size - 1;
+    if (resp->chunked)
+    {
+        for (;;)
+        {
+            char line[256];
+            if (!http_recv_line(h, line, sizeof(line)))
+            {
+                return 0;
+            }
+            unsigned long long chunk;
+            if (sscanf(line, "%llx", &chunk) != 1)
+            {
+                return http_fail(h, "invalid chunk in http response");
+            }
+            if (chunk == 0)
+            {
+                // skip trailer until empty line
+                do
+                {
+                    if (!http_recv_line(h, line, sizeof(line)))
+                    {
+                        return 0;
+                    }
+                }
+                while (line[0] != 0);
+                break;
+            }
+            if (!http_recv_store(h, chunk, buffer, capacity, &stored) || !http_recv_line(h, line, sizeof(line)))
+            {
+                return 0;
+            }
+        }
+    }
+    else if (resp->close && resp->total == 0)
+    {
+        // body without length ends when connection is closed
+        while (http_recv_store(h, sizeof(h->recv), buffer, capacity, &stored))
+        {
+        }
+    }
+    else if (!http_recv_store(h, resp->total, buffer, capacity, &stored))
+    {
+        return 0;
+    }
+
+    buffer[stored] = 0;
+    return 1;
+}
+
+int http_request(const char* method, const char* url, const char* headers, const void* body, uint32_t size, http_reply* reply)
+{
+    http h = sys_realloc(NULL, sizeof(*h));
+    memset(h, 0, sizeof(*h));
+    reply->error[0] = 0;
+    h->error = reply->error;
+
+    int result = 0;
+    if (http_parse_url(h, url) && (h->sock = sys_connect(h->host, h->port)) != NULL)
+    {
+        char request[8192];
+        int length = snprintf(request, sizeof(request),
+            "%s %s HTTP/1.1\r\n"
+            "Host: %s%s%s\r\n"
+            "Content-Length: %u\r\n"
+            "User-Agent: pkg2zip\r\n"
+            "Connection: close\r\n"
+            "%s"
+            "\r\n",
+            method, h->path, h->host, strcmp(h->port, "80") == 0 ? "" : ":", strcmp(h->port, "80") == 0 ? "" : h->port,
+            size, headers);
+        http_response resp;
+        if (length < 0 || length >= (int)sizeof(request))
+        {
+            http_fail(h, "http request is too large");
+        }
+        else if (sys_send(h->sock, request, length) && (size == 0 || sys_send(h->sock, body, size)) && http_recv_header(h, &resp))
+        {
+            reply->status = resp.status;
+            strcpy(reply->etag, resp.etag);
+            result = http_recv_reply(h, &resp, reply->body, sizeof(reply->body));
+        }
+    }
+    if (!result && reply->error[0] == 0)
+    {
+        http_fail(h, "connection to '%s' host failed", h->host);
+    }
+
+    http_disconnect(h);
+    sys_realloc(h, 0);
+    return result;
+}
+
+static void http_window_reserve(http h, uint32_t size)
+{
+    if (size > h->window_allocated)
+    {
+        h->window = sys_realloc(h->window, size);
+        h->window_allocated = size;
+    }
+}
+
+http http_open(const char* url, uint64_t* size)
+{
+    http h = sys_realloc(NULL, sizeof(*h));
+    memset(h, 0, sizeof(*h));
+    http_parse_url(h, url);
+
+    // first request gets file size together with pkg header
+    h->window_next = HTTP_WINDOW_MIN;
+    http_window_reserve(h, h->window_next);
+    h->window_size = http_fetch(h, 0, h->window, h->window_next);
+
+    *size = h->size;
+    return h;
+}
+
+void http_read(http h, uint64_t offset, void* buffer, uint32_t size)
+{
+    if (offset + size > h->size)
+    {
+        sys_error("ERROR: failed to read %u bytes from http server\n", size);
+    }
+
+    uint8_t* data = buffer;
+    while (size != 0)
+    {
+        uint64_t window_end = h->window_offset + h->window_size;
+        if (offset >= h->window_offset && offset < window_end)
+        {
+            uint32_t available = (uint32_t)min64(window_end - offset, size);
+            memcpy(data, h->window + (offset - h->window_offset), available);
+            data += available;
+            offset += available;
+            size -= available;
+            continue;
+        }
+
+        // sequential reads double request size, random access starts again from small one
+        if (offset == window_end)
+        {
+            h->window_next = min32(2 * h->window_next, HTTP_WINDOW_MAX);
+        }
+        else
+        {
+            h->window_next = HTTP_WINDOW_MIN;
+        }
+
+        if (size >= h->window_next)
+        {
+            // large read goes directly to caller
+            http_fetch(h, offset, data, size);
+            h->window_offset = offset + size;
+            h->window_size = 0;
+            return;
+        }
+
+        uint32_t request = (uint32_t)min64(h->window_next, h->size - offset);
+        http_window_reserve(h, request);
+        h->window_size = http_fetch(h, offset, h->window, request);
+        h->window_offset = offset;
+    }
+}
+
+void http_close(http h)
+{
+    http_disconnect(h);
+    if (h->window)
+    {
+        sys_realloc(h->window, 0);
+    }
+    sys_realloc(h, 0);
+}
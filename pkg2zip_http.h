@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef struct http_data* http;
+
+int http_is_url(const char* name);
+// returns total size of file, server must support range requests
+http http_open(const char* url, uint64_t* size);
+void http_read(http h, uint64_t offset, void* buffer, uint32_t size);
+void http_close(http h);
+
+#define HTTP_ERROR_SIZE 256
+
+typedef struct {
+    uint32_t status;
+    char etag[128];
+    // beginning of response body, zero terminated
+    char body[4096];
+    // why request failed
+    char error[HTTP_ERROR_SIZE];
+} http_reply;
+
+// sends single request with body over new connection, each line in headers must end with "\r\n"
+// never exits, returns 0 if request failed with reason in reply error, then request can be retried
+int http_request(const char* method, const char* url, const char* headers, const void* body, uint32_t size, http_reply* reply);
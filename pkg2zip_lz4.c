@@ -0,0 +1,203 @@
+#include "pkg2zip_lz4.h"
+#include "pkg2zip_utils.h"
+
+// https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+
+#define LZ4_HASH_BITS 12
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5 // last 5 bytes are always literals
+#define LZ4_MF_LIMIT 12 // last match must start at least 12 bytes before end
+#define LZ4_SKIP_TRIGGER 6 // incompressible data is skipped faster
+
+static uint32_t lz4_hash(uint32_t x)
+{
+    return (x * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+static uint8_t* lz4_write_length(uint8_t* output, uint32_t length)
+{
+    while (length >= 255)
+    {
+        *output++ = 255;
+        length -= 255;
+    }
+    *output++ = (uint8_t)length;
+    return output;
+}
+
+uint32_t lz4_compress(const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity)
+{
+    const uint8_t* ip = input;
+    const uint8_t* anchor = input;
+    const uint8_t* end = input + size;
+
+    uint8_t* op = output;
+    uint8_t* oend = output + capacity;
+
+    if (size > LZ4_MF_LIMIT)
+    {
+        const uint8_t* limit = end - LZ4_MF_LIMIT;
+        const uint8_t* match_limit = end - LZ4_LAST_LITERALS;
+
+        uint16_t table[1 << LZ4_HASH_BITS];
+        memset(table, 0, sizeof(table));
+
+        ip++;
+        while (ip < limit)
+        {
+            uint32_t sequence = get32le(ip);
+            uint32_t hash = lz4_hash(sequence);
+            const uint8_t* ref = input + table[hash];
+            table[hash] = (uint16_t)(ip - input);
+
+            if (get32le(ref) != sequence)
+            {
+                ip += 1 + ((ip - anchor) >> LZ4_SKIP_TRIGGER);
+                continue;
+            }
+
+            while (ip > anchor && ref > input && ip[-1] == ref[-1])
+            {
+                ip--;
+                ref--;
+            }
+
+            const uint8_t* mp = ip + LZ4_MIN_MATCH;
+            const uint8_t* mr = ref + LZ4_MIN_MATCH;
+            while (mp + 8 <= match_limit && get64le(mp) == get64le(mr))
+            {
+                mp += 8;
+                mr += 8;
+            }
+            while (mp < match_limit && *mp == *mr)
+            {
+                mp++;
+                mr++;
+            }
+
+            uint32_t literals = (uint32_t)(ip - anchor);
+            uint32_t match = (uint32_t)(mp - ip) - LZ4_MIN_MATCH;
+            if (op + 1 + literals / 255 + 1 + literals + 2 + match / 255 + 1 > oend)
+            {
+                return 0;
+            }
+
+            uint8_t* token = op++;
+            *token = (uint8_t)((min32(literals, 15) << 4) | min32(match, 15));
+            if (literals >= 15)
+            {
+                op = lz4_write_length(op, literals - 15);
+            }
+            memcpy(op, anchor, literals);
+            op += literals;
+
+            uint32_t offset = (uint32_t)(ip - ref);
+            *op++ = (uint8_t)offset;
+            *op++ = (uint8_t)(offset >> 8);
+            if (match >= 15)
+            {
+                op = lz4_write_length(op, match - 15);
+            }
+
+            anchor = ip = mp;
+            if (ip < limit)
+            {
+                // position right before next search is likely to start a match later
+                table[lz4_hash(get32le(ip - 2))] = (uint16_t)(ip - 2 - input);
+            }
+        }
+    }
+
+    uint32_t literals = (uint32_t)(end - anchor);
+    if (op + 1 + literals / 255 + 1 + literals > oend)
+    {
+        return 0;
+    }
+    *op++ = (uint8_t)(min32(literals, 15) << 4);
+    if (literals >= 15)
+    {
+        op = lz4_write_length(op, literals - 15);
+    }
+    memcpy(op, anchor, literals);
+    op += literals;
+
+    return (uint32_t)(op - output);
+}
+
+static int lz4_read_length(const uint8_t** input, const uint8_t* end, uint32_t* length)
+{
+    uint8_t byte;
+    do
+    {
+        if (*input == end)
+        {
+            return 0;
+        }
+        byte = *(*input)++;
+        *length += byte;
+    }
+    while (byte == 255);
+    return 1;
+}
+
+uint32_t lz4_decompress(const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity)
+{
+    const uint8_t* ip = input;
+    const uint8_t* end = input + size;
+
+    uint8_t* op = output;
+    uint8_t* oend = output + capacity;
+
+    while (ip < end)
+    {
+        uint8_t token = *ip++;
+
+        uint32_t literals = token >> 4;
+        if (literals == 15 && !lz4_read_length(&ip, end, &literals))
+        {
+            return 0;
+        }
+        if (literals > (uint32_t)(end - ip) || literals > (uint32_t)(oend - op))
+        {
+            return 0;
+        }
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+
+        // last sequence has only literals
+        if (ip == end)
+        {
+            break;
+        }
+
+        if (end - ip < 2)
+        {
+            return 0;
+        }
+        uint32_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        uint32_t match = token & 15;
+        if (match == 15 && !lz4_read_length(&ip, end, &match))
+        {
+            return 0;
+        }
+        match += LZ4_MIN_MATCH;
+
+        if (offset == 0 || offset > (uint32_t)(op - output) || match > (uint32_t)(oend - op))
+        {
+            return 0;
+        }
+
+        // match can overlap with output, so it is copied byte by byte
+        const uint8_t* ref = op - offset;
+        for (uint32_t i = 0; i < match; i++)
+        {
+            op[i] = ref[i];
+        }
+        op += match;
+    }
+
+    return (uint32_t)(op - output);
+}
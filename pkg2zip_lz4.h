@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+
+// max input size, offsets in hash table are 16-bit
+#define LZ4_MAX_INPUT_SIZE (64 * 1024)
+
+// compresses input into raw LZ4 block (no frame header)
+// returns 0 if compressed data does not fit in output
+uint32_t lz4_compress(const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity);
+
+// decompresses raw LZ4 block
+// returns size of decompressed data, or 0 if input is corrupted or does not fit in output
+uint32_t lz4_decompress(const uint8_t* input, uint32_t size, uint8_t* output, uint32_t capacity);
@@ -1,118 +1,370 @@
 #include "pkg2zip_out.h"
 #include "pkg2zip_sys.h"
 #include "pkg2zip_zip.h"
+#include "pkg2zip_tar.h"
 
-static zip out_zip;
-static int out_zipped;
-static sys_file out_file;
-static uint64_t out_file_offset;
+#include <stdio.h>
+#include <string.h>
 
-void out_begin(const char* name, int zipped)
+// for smaller files mapping costs more than writing
+#define OUT_MAP_MIN_SIZE (1024 * 1024)
+
+#define OUT_MAX_PATH 1024
+
+typedef struct {
+    out_format format;
+    zip zip;
+    tar tar;
+    uint64_t data_offset; // where current file data starts in zip
+    char root[OUT_MAX_PATH]; // prefix for folder target, empty for current folder
+    sys_file file;
+    uint64_t file_offset;
+} out_target;
+
+static out_target out_target_list[OUT_MAX_TARGETS];
+static uint32_t out_count;
+static uint32_t out_selected;
+
+static int out_is_selected(uint32_t index)
+{
+    return (out_selected >> index) & 1;
+}
+
+// full path of file or folder in folder target
+static char* out_path(const out_target* t, const char* path, char* buffer)
 {
-    if (zipped)
+    if (snprintf(buffer, 2 * OUT_MAX_PATH, "%s%s", t->root, path) >= 2 * OUT_MAX_PATH)
+    {
+        sys_error("ERROR: path too long\n");
+    }
+    return buffer;
+}
+
+void out_begin(const char* name, out_format format, int zstd_level, uint64_t split_size, uint32_t align)
+{
+    if (out_count == OUT_MAX_TARGETS)
+    {
+        sys_error("ERROR: too many outputs, max %u supported\n", OUT_MAX_TARGETS);
+    }
+
+    out_target* t = out_target_list + out_count;
+    t->format = format;
+    t->root[0] = 0;
+    if (format == OUT_FORMAT_ZIP)
+    {
+        zip_create(&t->zip, name, split_size, align);
+    }
+    else if (format != OUT_FORMAT_FOLDER)
     {
-        zip_create(&out_zip, name);
+        tar_create(&t->tar, name, format == OUT_FORMAT_TAR_ZSTD ? zstd_level : 0);
     }
-    out_zipped = zipped;
+    else if (name != NULL && name[0] != 0)
+    {
+        size_t length = strlen(name);
+        while (length > 1 && name[length - 1] == '/')
+        {
+            length--;
+        }
+        if (length + 1 >= sizeof(t->root))
+        {
+            sys_error("ERROR: folder name too long\n");
+        }
+        memcpy(t->root, name, length);
+        t->root[length] = 0;
+        sys_mkdir(t->root);
+
+        t->root[length] = '/';
+        t->root[length + 1] = 0;
+    }
+
+    out_count++;
+    out_selected = (1U << out_count) - 1;
 }
 
 void out_end(void)
 {
-    if (out_zipped)
+    for (uint32_t i = 0; i < out_count; i++)
+    {
+        out_target* t = out_target_list + i;
+        if (t->format == OUT_FORMAT_ZIP)
+        {
+            zip_close(&t->zip);
+        }
+        else if (t->format != OUT_FORMAT_FOLDER)
+        {
+            tar_close(&t->tar);
+        }
+    }
+    out_count = 0;
+    out_selected = 0;
+}
+
+uint32_t out_targets(void)
+{
+    return (1U << out_count) - 1;
+}
+
+uint32_t out_folders(void)
+{
+    uint32_t folders = 0;
+    for (uint32_t i = 0; i < out_count; i++)
     {
-        zip_close(&out_zip);
+        if (out_target_list[i].format == OUT_FORMAT_FOLDER)
+        {
+            folders |= 1U << i;
+        }
     }
+    return folders;
+}
+
+uint32_t out_select(uint32_t targets)
+{
+    uint32_t previous = out_selected;
+    out_selected = targets & out_targets();
+    return previous;
 }
 
 void out_add_folder(const char* path)
 {
-    if (out_zipped)
+    for (uint32_t i = 0; i < out_count; i++)
     {
-        zip_add_folder(&out_zip, path);
+        out_target* t = out_target_list + i;
+        if (!out_is_selected(i))
+        {
+            continue;
+        }
+
+        if (t->format == OUT_FORMAT_ZIP)
+        {
+            zip_add_folder(&t->zip, path);
+        }
+        else if (t->format != OUT_FORMAT_FOLDER)
+        {
+            tar_add_folder(&t->tar, path);
+        }
+        else
+        {
+            char buffer[2 * OUT_MAX_PATH];
+            sys_mkdir(out_path(t, path, buffer));
+        }
     }
-    else
+}
+
+void out_begin_file(const char* name, int level)
+{
+    for (uint32_t i = 0; i < out_count; i++)
     {
-        sys_mkdir(path);
+        out_target* t = out_target_list + i;
+        if (!out_is_selected(i))
+        {
+            continue;
+        }
+
+        t->data_offset = 0;
+        if (t->format == OUT_FORMAT_ZIP)
+        {
+            t->data_offset = zip_begin_file(&t->zip, name, level);
+        }
+        else if (t->format != OUT_FORMAT_FOLDER)
+        {
+            tar_begin_file(&t->tar, name);
+        }
+        else
+        {
+            char buffer[2 * OUT_MAX_PATH];
+            t->file = sys_create(out_path(t, name, buffer));
+            sys_sparse(t->file);
+            t->file_offset = 0;
+        }
     }
 }
 
-uint64_t out_begin_file(const char* name, int compress)
+int out_level(int level, const void* data, uint32_t size)
 {
-    if (out_zipped)
+    if (!(level & OUT_LEVEL_ADAPTIVE))
     {
-        return zip_begin_file(&out_zip, name, compress);
+        return level;
     }
-    else
+
+    // all zip targets use same level, so it is checked only with first of them
+    for (uint32_t i = 0; i < out_count; i++)
     {
-        out_file = sys_create(name);
-        out_file_offset = 0;
-        return 0;
+        out_target* t = out_target_list + i;
+        if (out_is_selected(i) && t->format == OUT_FORMAT_ZIP)
+        {
+            return zip_compressible(&t->zip, data, size) ? level & ~OUT_LEVEL_ADAPTIVE : 0;
+        }
     }
+    return 0;
 }
 
 void out_end_file(void)
 {
-    if (out_zipped)
+    for (uint32_t i = 0; i < out_count; i++)
     {
-        zip_end_file(&out_zip);
-    }
-    else
-    {
-        sys_close(out_file);
+        out_target* t = out_target_list + i;
+        if (!out_is_selected(i))
+        {
+            continue;
+        }
+
+        if (t->format == OUT_FORMAT_ZIP)
+        {
+            zip_end_file(&t->zip);
+        }
+        else if (t->format != OUT_FORMAT_FOLDER)
+        {
+            tar_end_file(&t->tar);
+        }
+        else
+        {
+            sys_close(t->file);
+        }
     }
 }
 
 void out_write(const void* buffer, uint32_t size)
 {
-    if (out_zipped)
+    for (uint32_t i = 0; i < out_count; i++)
     {
-        zip_write_file(&out_zip, buffer, size);
+        out_target* t = out_target_list + i;
+        if (!out_is_selected(i))
+        {
+            continue;
+        }
+
+        if (t->format == OUT_FORMAT_ZIP)
+        {
+            zip_write_file(&t->zip, buffer, size);
+        }
+        else if (t->format != OUT_FORMAT_FOLDER)
+        {
+            tar_write_file(&t->tar, buffer, size);
+        }
+        else
+        {
+            sys_write(t->file, t->file_offset, buffer, size);
+            t->file_offset += size;
+        }
     }
-    else
+}
+
+void out_reserve(uint64_t size)
+{
+    for (uint32_t i = 0; i < out_count; i++)
     {
-        sys_write(out_file, out_file_offset, buffer, size);
-        out_file_offset += size;
+        out_target* t = out_target_list + i;
+        if (!out_is_selected(i))
+        {
+            continue;
+        }
+
+        if (t->format == OUT_FORMAT_ZIP)
+        {
+            zip_reserve(&t->zip, size);
+        }
+        else if (t->format != OUT_FORMAT_FOLDER)
+        {
+            tar_reserve(&t->tar, size);
+        }
+        else
+        {
+            sys_reserve(t->file, t->file_offset + size);
+        }
     }
 }
 
-void out_write_at(uint64_t offset, const void* buffer, uint32_t size)
+void* out_map(uint64_t size)
 {
-    if (out_zipped)
+    // mapped data would need to be copied to other targets, so only single folder is mapped
+    if (out_selected == 0 || (out_selected & (out_selected - 1)) != 0 || size < OUT_MAP_MIN_SIZE)
     {
-        zip_write_file_at(&out_zip, offset, buffer, size);
+        return NULL;
     }
-    else
+
+    for (uint32_t i = 0; i < out_count; i++)
     {
-        sys_write(out_file, offset, buffer, size);
+        out_target* t = out_target_list + i;
+        if (out_is_selected(i) && t->format == OUT_FORMAT_FOLDER)
+        {
+            return sys_map(t->file, size);
+        }
     }
+    return NULL;
 }
 
-void out_set_offset(uint64_t offset)
+void out_write_at(uint64_t offset, const void* buffer, uint32_t size)
 {
-    if (out_zipped)
+    for (uint32_t i = 0; i < out_count; i++)
     {
-        zip_set_offset(&out_zip, offset);
+        out_target* t = out_target_list + i;
+        if (!out_is_selected(i))
+        {
+            continue;
+        }
+
+        if (t->format == OUT_FORMAT_ZIP)
+        {
+            zip_write_file_at(&t->zip, t->data_offset + offset, buffer, size);
+        }
+        else if (t->format != OUT_FORMAT_FOLDER)
+        {
+            tar_write_file_at(&t->tar, offset, buffer, size);
+        }
+        else
+        {
+            sys_write(t->file, offset, buffer, size);
+        }
     }
-    else
+}
+
+void out_set_offset(uint64_t offset)
+{
+    for (uint32_t i = 0; i < out_count; i++)
     {
-        out_file_offset = offset;
+        out_target* t = out_target_list + i;
+        if (!out_is_selected(i))
+        {
+            continue;
+        }
 
+        if (t->format == OUT_FORMAT_ZIP)
+        {
+            zip_set_offset(&t->zip, t->data_offset + offset);
+        }
+        else if (t->format != OUT_FORMAT_FOLDER)
+        {
+            tar_set_offset(&t->tar, offset);
+        }
+        else
+        {
+            t->file_offset = offset;
+        }
     }
 }
 
 uint32_t out_zip_get_crc32(void)
 {
-    if (out_zipped)
+    // every selected target gets same data, so any zip has same crc
+    for (uint32_t i = 0; i < out_count; i++)
     {
-        return zip_get_crc32(&out_zip);
+        out_target* t = out_target_list + i;
+        if (out_is_selected(i) && t->format == OUT_FORMAT_ZIP)
+        {
+            return zip_get_crc32(&t->zip);
+        }
     }
     return 0;
 }
 
 void out_zip_set_crc32(uint32_t crc)
 {
-    if (out_zipped)
+    for (uint32_t i = 0; i < out_count; i++)
     {
-        zip_set_crc32(&out_zip, crc);
+        out_target* t = out_target_list + i;
+        if (out_is_selected(i) && t->format == OUT_FORMAT_ZIP)
+        {
+            zip_set_crc32(&t->zip, crc);
+        }
     }
 }
@@ -2,14 +2,47 @@
 
 #include <stdint.h>
 
-void out_begin(const char* name, int zipped);
+typedef enum {
+    OUT_FORMAT_FOLDER,
+    OUT_FORMAT_ZIP,
+    OUT_FORMAT_TAR,
+    OUT_FORMAT_TAR_ZSTD,
+} out_format;
+
+// output can go to several targets at once, data is decrypted once and written to each of them
+#define OUT_MAX_TARGETS 8
+
+// adds new target, for OUT_FORMAT_FOLDER name is folder where files are created (NULL for current one)
+// zstd level is used only for OUT_FORMAT_TAR_ZSTD
+// split size and alignment of stored files only for OUT_FORMAT_ZIP (0 is not split or aligned)
+void out_begin(const char* name, out_format format, int zstd_level, uint64_t split_size, uint32_t align);
+// finishes all targets
 void out_end(void);
+// bit masks of all targets and of folder targets
+uint32_t out_targets(void);
+uint32_t out_folders(void);
+// following calls go only to these targets, returns previous selection
+// after out_begin all targets are selected
+uint32_t out_select(uint32_t targets);
+
 void out_add_folder(const char* path);
-uint64_t out_begin_file(const char* name, int compress);
+// level 0 stores file in zip, 1..9 deflates it, ZIP_LEVEL_ZSTD|N uses zstd
+void out_begin_file(const char* name, int level);
 void out_end_file(void);
+// adaptive level deflates only files that start with compressible data
+#define OUT_LEVEL_ADAPTIVE 0x100
+// returns level for file starting with this data
+int out_level(int level, const void* data, uint32_t size);
 void out_write(const void* buffer, uint32_t size);
+// expected size of data that will be written next, to preallocate space for it
+// for tar output, first call after out_begin_file declares exact size of file
+void out_reserve(uint64_t size);
+// maps whole file of exact size in memory, data is put there instead of out_write
+// returns NULL for zip, tar, small files or when more than one target is selected, then out_write must be used
+void* out_map(uint64_t size);
 
 // hacky solution to be able to write cso header after the data is written
+// offsets are relative to beginning of current file data
 void out_write_at(uint64_t offset, const void* buffer, uint32_t size);
 void out_set_offset(uint64_t offset);
 uint32_t out_zip_get_crc32(void);
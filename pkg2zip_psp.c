@@ -1,16 +1,13 @@
 #include "pkg2zip_psp.h"
 #include "pkg2zip_out.h"
-#include "pkg2zip_crc32.h"
 #include "pkg2zip_utils.h"
-#include "miniz_tdef.h"
 
 #include <assert.h>
+#include <stdio.h>
 #include <string.h>
 
 #define ISO_SECTOR_SIZE 2048
 
-#define CSO_HEADER_SIZE 24
-
 // https://vitadevwiki.com/vita/Keys_NonVita#PSPAESKirk4.2F7
 static const uint8_t kirk7_key38[] = { 0x12, 0x46, 0x8d, 0x7e, 0x1c, 0x42, 0x20, 0x9b, 0xba, 0x54, 0x26, 0x83, 0x5e, 0xb0, 0x33, 0x03 };
 static const uint8_t kirk7_key39[] = { 0xc4, 0x3b, 0xb6, 0xd6, 0x53, 0xee, 0x67, 0x49, 0x3e, 0xa9, 0x5f, 0xbc, 0x0c, 0xed, 0x6f, 0x8a };
@@ -311,7 +308,22 @@ static void init_psp_decrypt(aes128_key* key, uint8_t* iv, int eboot, const uint
     }
 }
 
-void unpack_psp_eboot(const char* path, const aes128_key* pkg_key, const uint8_t* pkg_iv, sys_file* pkg, uint64_t enc_offset, uint64_t item_offset, uint64_t item_size, int cso)
+// mapped iso already has the block, so only cso needs it
+static void psp_write_block(uint32_t iso_targets, const uint8_t* iso, uint32_t cso_targets, cso_writer* writer, const uint8_t* data, uint32_t size)
+{
+    if (iso_targets && iso == NULL)
+    {
+        out_select(iso_targets);
+        out_write(data, size);
+    }
+    if (writer)
+    {
+        out_select(cso_targets);
+        cso_write(writer, data, size);
+    }
+}
+
+void unpack_psp_eboot(const char* path, const aes128_key* pkg_key, const uint8_t* pkg_iv, sys_file pkg, uint64_t enc_offset, uint64_t item_offset, uint64_t item_size, const cso_options* cso, int level, uint32_t iso_targets)
 {
     if (item_size < 0x28)
     {
@@ -369,40 +381,51 @@ void unpack_psp_eboot(const char* path, const aes128_key* pkg_key, const uint8_t
         sys_error("ERROR: offset table in data.psar file is too large!\n");
     }
 
-    mz_uint cso_compress_flags = 0;
-    uint32_t cso_index = 0;
-    uint32_t cso_offset = 0;
-    uint64_t cso_size = 0;
-    uint32_t* cso_block = NULL;
-    uint32_t initial_size = 0;
+    uint64_t iso_size = (uint64_t)block_count * iso_block * ISO_SECTOR_SIZE;
 
-    uint64_t file_offset = out_begin_file(path, !cso);
-    if (cso)
-    {
-        cso_size = block_count * iso_block * ISO_SECTOR_SIZE;
-        cso_compress_flags = tdefl_create_comp_flags_from_zip_params(cso, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
+    // same decrypted image can go as .ISO to some targets and as .CSO to others
+    uint32_t targets = out_select(0);
+    iso_targets = cso->format == CSO_FORMAT_ISO ? targets : iso_targets & targets;
+    uint32_t cso_targets = targets & ~iso_targets;
 
-        uint32_t cso_block_count = (uint32_t)(1 + (cso_size + ISO_SECTOR_SIZE - 1) / ISO_SECTOR_SIZE);
-        cso_block = sys_realloc(NULL, cso_block_count * sizeof(uint32_t));
+    char name[1024];
 
-        initial_size = CSO_HEADER_SIZE + cso_block_count * sizeof(uint32_t);
-        out_set_offset(file_offset + initial_size);
+    uint8_t* iso = NULL;
+    if (iso_targets)
+    {
+        snprintf(name, sizeof(name), "%s.iso", path);
+        out_select(iso_targets);
+        out_begin_file(name, level);
 
-        cso_offset = initial_size;
+        // when iso is mapped, blocks are decrypted and decompressed directly in it
+        iso = out_map(iso_size);
+        if (iso == NULL)
+        {
+            out_reserve(iso_size);
+        }
     }
 
-    for (uint32_t i = 0; i < block_count; i++)
+    cso_writer* writer = NULL;
+    if (cso_targets)
     {
-        uint64_t table_offset = item_offset + psar_offset + iso_table + 32 * i;
+        snprintf(name, sizeof(name), "%s.%s", path, cso->format == CSO_FORMAT_ZSO ? "zso" : "cso");
+        out_select(cso_targets);
+        out_begin_file(name, 0);
+        writer = cso_begin(cso, iso_size);
+    }
 
-        uint8_t table[32];
-        sys_read(pkg, enc_offset + table_offset, table, sizeof(table));
-        aes128_ctr_xor(pkg_key, pkg_iv, table_offset / 16, table, sizeof(table));
+    // whole offset table is read at once, so block data can be read sequentially
+    uint64_t table_offset = item_offset + psar_offset + iso_table;
+    uint8_t* table = sys_realloc(NULL, (block_count + 1) * 32);
+    sys_read(pkg, enc_offset + table_offset, table, block_count * 32);
+    aes128_ctr_xor(pkg_key, pkg_iv, table_offset / 16, table, block_count * 32);
 
+    for (uint32_t i = 0; i < block_count; i++)
+    {
         uint32_t t[8];
         for (size_t k = 0; k < 8; k++)
         {
-            t[k] = get32le(table + k * 4);
+            t[k] = get32le(table + 32 * i + k * 4);
         }
 
         uint32_t block_offset = t[4] ^ t[2] ^ t[3];
@@ -414,7 +437,9 @@ void unpack_psp_eboot(const char* path, const aes128_key* pkg_key, const uint8_t
             sys_error("ERROR: iso block size/offset is to large!\n");
         }
 
-        uint8_t PKG_ALIGN(16) data[16 * ISO_SECTOR_SIZE];
+        uint8_t PKG_ALIGN(16) buffer[16 * ISO_SECTOR_SIZE];
+        uint8_t* iso_data = iso ? iso + (uint64_t)i * iso_block * ISO_SECTOR_SIZE : NULL;
+        uint8_t* data = iso && block_size == iso_block * ISO_SECTOR_SIZE ? iso_data : buffer;
 
         uint64_t abs_offset = item_offset + psar_offset + block_offset;
         sys_output_progress(enc_offset + abs_offset);
@@ -429,116 +454,39 @@ void unpack_psp_eboot(const char* path, const aes128_key* pkg_key, const uint8_t
         uint32_t out_size;
         if (block_size == iso_block * ISO_SECTOR_SIZE)
         {
-            if (cso)
-            {
-                for (size_t n = 0; n < iso_block * ISO_SECTOR_SIZE; n += ISO_SECTOR_SIZE)
-                {
-                    cso_block[cso_index] = cso_offset;
-
-                    uint8_t PKG_ALIGN(16) output[ISO_SECTOR_SIZE];
-                    size_t insize = ISO_SECTOR_SIZE;
-                    size_t outsize = sizeof(output);
-
-                    tdefl_compressor c;
-                    tdefl_init(&c, cso_compress_flags);
-                    tdefl_status st = tdefl_compress(&c, data + n, &insize, output, &outsize, TDEFL_FINISH);
-                    if (st == TDEFL_STATUS_DONE)
-                    {
-                        out_write(output, (uint32_t)outsize);
-                        cso_offset += (uint32_t)outsize;
-                    }
-                    else
-                    {
-                        cso_block[cso_index] |= 0x80000000;
-                        out_write(data + n, ISO_SECTOR_SIZE);
-                        cso_offset += ISO_SECTOR_SIZE;
-                    }
-                    cso_index++;
-                }
-            }
-            else
-            {
-                out_write(data, (uint32_t)block_size);
-            }
+            psp_write_block(iso_targets, iso, cso_targets, writer, data, block_size);
         }
         else
         {
-            uint8_t PKG_ALIGN(16) uncompressed[16 * ISO_SECTOR_SIZE];
-            out_size = lzrc_decompress(uncompressed, sizeof(uncompressed), data, block_size);
+            uint8_t PKG_ALIGN(16) buffer_uncompressed[16 * ISO_SECTOR_SIZE];
+            uint8_t* uncompressed = iso ? iso_data : buffer_uncompressed;
+            out_size = lzrc_decompress(uncompressed, iso ? iso_block * ISO_SECTOR_SIZE : sizeof(buffer_uncompressed), data, block_size);
             if (out_size != iso_block * ISO_SECTOR_SIZE)
             {
                 sys_error("ERROR: internal error - lzrc decompression failed! pkg may be corrupted?\n");
             }
-            if (cso)
-            {
-                for (size_t n = 0; n < iso_block * ISO_SECTOR_SIZE; n += ISO_SECTOR_SIZE)
-                {
-                    cso_block[cso_index] = cso_offset;
-
-                    uint8_t output[ISO_SECTOR_SIZE];
-                    size_t insize = ISO_SECTOR_SIZE;
-                    size_t outsize = sizeof(output);
-
-                    tdefl_compressor c;
-                    tdefl_init(&c, cso_compress_flags);
-                    tdefl_status st = tdefl_compress(&c, uncompressed + n, &insize, output, &outsize, TDEFL_FINISH);
-                    if (st == TDEFL_STATUS_DONE)
-                    {
-                        out_write(output, (uint32_t)outsize);
-                        cso_offset += (uint32_t)outsize;
-                    }
-                    else
-                    {
-                        cso_block[cso_index] |= 0x80000000;
-                        out_write(uncompressed + n, ISO_SECTOR_SIZE);
-                        cso_offset += ISO_SECTOR_SIZE;
-                    }
-                    cso_index++;
-                }
-            }
-            else
-            {
-                out_write(uncompressed, (uint32_t)out_size);
-            }
+            psp_write_block(iso_targets, iso, cso_targets, writer, uncompressed, out_size);
         }
     }
 
-    if (cso)
+    sys_realloc(table, 0);
+
+    if (writer)
     {
-        cso_block[cso_index++] = cso_offset;
-
-        uint8_t cso_header[CSO_HEADER_SIZE] = { 0x43, 0x49, 0x53, 0x4f };
-        // header size
-        set32le(cso_header + 4, sizeof(cso_header));
-        // original size
-        set64le(cso_header + 8, cso_size);
-        // block size
-        set32le(cso_header + 16, ISO_SECTOR_SIZE);
-        // version
-        cso_header[20] = 1;
-
-        out_write_at(file_offset, cso_header, sizeof(cso_header));
-        out_write_at(file_offset + sizeof(cso_header), cso_block, cso_index * sizeof(uint32_t));
-
-        crc32_ctx cheader;
-        crc32_init(&cheader);
-        crc32_update(&cheader, cso_header, sizeof(cso_header));
-        crc32_update(&cheader, cso_block, cso_index * sizeof(uint32_t));
-
-        uint32_t header_crc32 = crc32_done(&cheader);
-        uint32_t data_crc32 = out_zip_get_crc32();
-        uint32_t data_len = (uint32_t)(cso_offset - initial_size);
-
-        uint32_t crc32 = crc32_combine(header_crc32, data_crc32, data_len);
-        out_zip_set_crc32(crc32);
-
-        sys_realloc(cso_block, 0);
+        out_select(cso_targets);
+        cso_end(writer);
+        out_end_file();
+    }
+    if (iso_targets)
+    {
+        out_select(iso_targets);
+        out_end_file();
     }
 
-    out_end_file();
+    out_select(targets);
 }
 
-void unpack_psp_key(const char* path, const aes128_key* pkg_key, const uint8_t* pkg_iv, sys_file* pkg, uint64_t enc_offset, uint64_t item_offset, uint64_t item_size)
+void unpack_psp_key(const char* path, const aes128_key* pkg_key, const uint8_t* pkg_iv, sys_file pkg, uint64_t enc_offset, uint64_t item_offset, uint64_t item_size)
 {
     if (item_size < 0x90 + 0xa0)
     {
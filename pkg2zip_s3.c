@@ -0,0 +1,547 @@
+#include "pkg2zip_s3.h"
+#include "pkg2zip_http.h"
+#include "pkg2zip_sha256.h"
+#include "pkg2zip_sys.h"
+#include "pkg2zip_utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// https://docs.aws.amazon.com/AmazonS3/latest/userguide/mpuoverview.html
+// https://docs.aws.amazon.com/AmazonS3/latest/API/sig-v4-header-based-auth.html
+
+// all parts except last must be at least 5 MB, upload can have at most 10000 parts
+// part size is doubled after every 1000 parts, so 10000 parts can hold more than 16 TB
+#define S3_PART_SIZE (16 * 1024 * 1024)
+#define S3_PART_SIZE_MAX (1024 * 1024 * 1024)
+#define S3_PARTS_PER_SIZE 1000
+#define S3_MAX_PARTS 10000
+
+// parts are uploaded in background while next ones are being written
+#define S3_MAX_UPLOADS 4
+#define S3_MAX_ATTEMPTS 3
+
+#define S3_DATE_SIZE 17
+#define S3_ETAG_SIZE 128
+#define S3_ERROR_SIZE (HTTP_ERROR_SIZE + 512)
+
+typedef struct s3_sink s3_sink;
+
+typedef struct {
+    s3_sink* s3;
+    sys_thread thread;
+    uint32_t number;
+    uint8_t* data;
+    uint32_t size;
+    uint32_t allocated;
+    char date[S3_DATE_SIZE];
+    char etag[S3_ETAG_SIZE];
+    // upload threads do not exit on error, main thread reports it after all uploads finish
+    char error[S3_ERROR_SIZE];
+} s3_part;
+
+typedef struct {
+    char value[S3_ETAG_SIZE];
+} s3_etag;
+
+struct s3_sink
+{
+    sink base;
+
+    char host[256];
+    char path[2048];
+    char access_key[128];
+    char secret_key[128];
+    char token[2048];
+    char region[64];
+    char upload_id[512];
+
+    // part that is being filled
+    uint8_t* buffer;
+    uint32_t buffered;
+    uint32_t allocated;
+    uint32_t part_size;
+
+    // parts that are being uploaded, oldest is first
+    s3_part uploads[S3_MAX_UPLOADS];
+    uint32_t first;
+    uint32_t active;
+
+    uint32_t parts;
+    s3_etag* etags;
+
+    // next upload that is not completed yet
+    s3_sink* pending;
+};
+
+static void s3_hex(const uint8_t* data, size_t size, char* hex)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < size; i++)
+    {
+        hex[2 * i + 0] = digits[data[i] >> 4];
+        hex[2 * i + 1] = digits[data[i] & 15];
+    }
+    hex[2 * size] = 0;
+}
+
+// percent encodes everything except unreserved characters, and also except '/' if slash is set
+static void s3_encode(const char* str, size_t length, int slash, char* out, size_t size)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    size_t pos = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        uint8_t ch = (uint8_t)str[i];
+        if (pos + 4 > size)
+        {
+            sys_error("ERROR: upload url is too long\n");
+        }
+        if ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '-' || ch == '.' || ch == '_' || ch == '~' || (slash && ch == '/'))
+        {
+            out[pos++] = (char)ch;
+        }
+        else
+        {
+            out[pos++] = '%';
+            out[pos++] = digits[ch >> 4];
+            out[pos++] = digits[ch & 15];
+        }
+    }
+    out[pos] = 0;
+}
+
+static void s3_date(char* date)
+{
+    time_t t = time(NULL);
+    struct tm* tm = gmtime(&t);
+    strftime(date, S3_DATE_SIZE, "%Y%m%dT%H%M%SZ", tm);
+}
+
+// copies text between <tag> and </tag> from xml, returns 0 if tag is not found
+static int s3_xml_value(const char* xml, const char* tag, char* value, size_t size)
+{
+    char open[64];
+    char close[64];
+    snprintf(open, sizeof(open), "<%s>", tag);
+    snprintf(close, sizeof(close), "</%s>", tag);
+
+    const char* start = strstr(xml, open);
+    if (start == NULL)
+    {
+        return 0;
+    }
+    start += strlen(open);
+    const char* end = strstr(start, close);
+    if (end == NULL || (size_t)(end - start) >= size)
+    {
+        return 0;
+    }
+    memcpy(value, start, end - start);
+    value[end - start] = 0;
+    return 1;
+}
+
+static void s3_status_error(const char* action, const http_reply* reply, char* error)
+{
+    char code[256];
+    if (!s3_xml_value(reply->body, "Code", code, sizeof(code)))
+    {
+        strcpy(code, "unknown error");
+    }
+    snprintf(error, S3_ERROR_SIZE, "failed to %s, server returned status %u (%s)", action, reply->status, code);
+}
+
+static void NORETURN s3_fail(const char* action, const http_reply* reply)
+{
+    char error[S3_ERROR_SIZE];
+    s3_status_error(action, reply, error);
+    sys_error("ERROR: %s\n", error);
+}
+
+static void s3_send_error(const s3_sink* s3, const http_reply* reply, char* error)
+{
+    if (reply->error[0])
+    {
+        snprintf(error, S3_ERROR_SIZE, "failed to upload to '%s' host (%s)", s3->host, reply->error);
+    }
+    else
+    {
+        snprintf(error, S3_ERROR_SIZE, "failed to upload to '%s' host (server returned status %u)", s3->host, reply->status);
+    }
+}
+
+// signs request with AWS signature version 4 and sends it, query must be in canonical form
+// returns 0 if request could not be sent
+static int s3_send(const s3_sink* s3, const char* method, const char* query, const void* body, uint32_t size, const char* date, http_reply* reply)
+{
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    char payload_hash[2 * SHA256_DIGEST_SIZE + 1];
+    sha256_ctx ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, body, size);
+    sha256_done(&ctx, digest);
+    s3_hex(digest, sizeof(digest), payload_hash);
+
+    char token_header[2100] = "";
+    const char* signed_headers = "host;x-amz-content-sha256;x-amz-date";
+    if (s3->token[0])
+    {
+        snprintf(token_header, sizeof(token_header), "x-amz-security-token:%s\n", s3->token);
+        signed_headers = "host;x-amz-content-sha256;x-amz-date;x-amz-security-token";
+    }
+
+    char canonical[8192];
+    snprintf(canonical, sizeof(canonical), "%s\n%s\n%s\nhost:%s\nx-amz-content-sha256:%s\nx-amz-date:%s\n%s\n%s\n%s",
+        method, s3->path, query, s3->host, payload_hash, date, token_header, signed_headers, payload_hash);
+
+    char canonical_hash[2 * SHA256_DIGEST_SIZE + 1];
+    sha256_init(&ctx);
+    sha256_update(&ctx, canonical, strlen(canonical));
+    sha256_done(&ctx, digest);
+    s3_hex(digest, sizeof(digest), canonical_hash);
+
+    char scope[256];
+    snprintf(scope, sizeof(scope), "%.8s/%s/s3/aws4_request", date, s3->region);
+
+    char string_to_sign[512];
+    snprintf(string_to_sign, sizeof(string_to_sign), "AWS4-HMAC-SHA256\n%s\n%s\n%s", date, scope, canonical_hash);
+
+    // signing key is derived from secret key, date, region and service
+    char secret[256];
+    snprintf(secret, sizeof(secret), "AWS4%s", s3->secret_key);
+    uint8_t key[SHA256_DIGEST_SIZE];
+    hmac_sha256(secret, strlen(secret), date, 8, key);
+    hmac_sha256(key, sizeof(key), s3->region, strlen(s3->region), key);
+    hmac_sha256(key, sizeof(key), "s3", 2, key);
+    hmac_sha256(key, sizeof(key), "aws4_request", 12, key);
+    hmac_sha256(key, sizeof(key), string_to_sign, strlen(string_to_sign), digest);
+
+    char signature[2 * SHA256_DIGEST_SIZE + 1];
+    s3_hex(digest, sizeof(digest), signature);
+
+    char headers[4096];
+    snprintf(headers, sizeof(headers),
+        "x-amz-content-sha256: %s\r\n"
+        "x-amz-date: %s\r\n"
+        "%s%s%s"
+        "Authorization: AWS4-HMAC-SHA256 Credential=%s/%s, SignedHeaders=%s, Signature=%s\r\n",
+        payload_hash, date,
+        s3->token[0] ? "x-amz-security-token: " : "", s3->token, s3->token[0] ? "\r\n" : "",
+        s3->access_key, scope, signed_headers, signature);
+
+    char url[4096];
+    snprintf(url, sizeof(url), "http://%s%s?%s", s3->host, s3->path, query);
+
+    // connection errors and server errors are retried
+    for (uint32_t attempt = 0; attempt < S3_MAX_ATTEMPTS; attempt++)
+    {
+        if (http_request(method, url, headers, body, size, reply) && reply->status < 500)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void s3_request(const s3_sink* s3, const char* method, const char* query, const void* body, uint32_t size, const char* date, http_reply* reply)
+{
+    if (!s3_send(s3, method, query, body, size, date, reply))
+    {
+        char error[S3_ERROR_SIZE];
+        s3_send_error(s3, reply, error);
+        sys_error("ERROR: %s\n", error);
+    }
+}
+
+static void s3_upload_part(void* arg)
+{
+    s3_part* part = arg;
+    const s3_sink* s3 = part->s3;
+
+    char query[1024];
+    snprintf(query, sizeof(query), "partNumber=%u&uploadId=%s", part->number, s3->upload_id);
+
+    http_reply reply;
+    part->error[0] = 0;
+    if (!s3_send(s3, "PUT", query, part->data, part->size, part->date, &reply))
+    {
+        s3_send_error(s3, &reply, part->error);
+    }
+    else if (reply.status != 200 || reply.etag[0] == 0)
+    {
+        s3_status_error("upload part", &reply, part->error);
+    }
+    else
+    {
+        strcpy(part->etag, reply.etag);
+    }
+}
+
+// waits until oldest part is uploaded, returns it
+static s3_part* s3_join(s3_sink* s3)
+{
+    s3_part* part = s3->uploads + s3->first;
+    sys_thread_join(part->thread);
+
+    s3->first = (s3->first + 1) % S3_MAX_UPLOADS;
+    s3->active--;
+    return part;
+}
+
+static void s3_wait(s3_sink* s3)
+{
+    s3_part* part = s3_join(s3);
+    if (part->error[0])
+    {
+        // no upload can be running when upload is aborted at exit
+        while (s3->active != 0)
+        {
+            s3_join(s3);
+        }
+        sys_error("ERROR: %s\n", part->error);
+    }
+    strcpy(s3->etags[part->number - 1].value, part->etag);
+}
+
+// uploads that are started but not completed, server keeps their parts until upload is aborted
+static s3_sink* s3_pending;
+
+// called at exit, so any error after upload has started deletes already uploaded parts
+// it must not exit again, so errors are only printed
+static void s3_abort(void)
+{
+    while (s3_pending != NULL)
+    {
+        s3_sink* s3 = s3_pending;
+        s3_pending = s3->pending;
+
+        // part that finishes after abort would stay on server
+        while (s3->active != 0)
+        {
+            s3_join(s3);
+        }
+
+        char query[1024];
+        snprintf(query, sizeof(query), "uploadId=%s", s3->upload_id);
+
+        char date[S3_DATE_SIZE];
+        s3_date(date);
+
+        http_reply reply;
+        if (!s3_send(s3, "DELETE", query, "", 0, date, &reply) || (reply.status != 204 && reply.status != 200 && reply.status != 404))
+        {
+            fprintf(stderr, "ERROR: failed to abort upload, upload id is %s\n", s3->upload_id);
+        }
+    }
+}
+
+// starts uploading filled buffer as next part
+static void s3_flush(s3_sink* s3)
+{
+    if (s3->parts == S3_MAX_PARTS)
+    {
+        sys_error("ERROR: too many parts for upload\n");
+    }
+    if (s3->active == S3_MAX_UPLOADS)
+    {
+        s3_wait(s3);
+    }
+
+    if (s3->parts % S3_PARTS_PER_SIZE == 0)
+    {
+        s3->etags = sys_realloc(s3->etags, (s3->parts + S3_PARTS_PER_SIZE) * sizeof(s3_etag));
+    }
+
+    // part takes filled buffer, and its previous buffer will be filled next
+    s3_part* part = s3->uploads + (s3->first + s3->active) % S3_MAX_UPLOADS;
+    uint8_t* data = part->data;
+    uint32_t allocated = part->allocated;
+    part->s3 = s3;
+    part->number = ++s3->parts;
+    part->data = s3->buffer;
+    part->size = s3->buffered;
+    part->allocated = s3->allocated;
+    s3_date(part->date);
+    part->thread = sys_thread_start(s3_upload_part, part);
+    s3->active++;
+
+    s3->buffer = data;
+    s3->buffered = 0;
+    s3->allocated = allocated;
+
+    if (s3->parts % S3_PARTS_PER_SIZE == 0 && s3->part_size < S3_PART_SIZE_MAX)
+    {
+        s3->part_size *= 2;
+    }
+    if (s3->allocated < s3->part_size)
+    {
+        s3->buffer = sys_realloc(s3->buffer, s3->part_size);
+        s3->allocated = s3->part_size;
+    }
+}
+
+static void s3_write(sink* s, const void* data, uint32_t size)
+{
+    s3_sink* s3 = (s3_sink*)s;
+    const uint8_t* data8 = data;
+    while (size != 0)
+    {
+        uint32_t chunk = min32(size, s3->part_size - s3->buffered);
+        memcpy(s3->buffer + s3->buffered, data8, chunk);
+        s3->buffered += chunk;
+        data8 += chunk;
+        size -= chunk;
+
+        if (s3->buffered == s3->part_size)
+        {
+            s3_flush(s3);
+        }
+    }
+}
+
+static void s3_end(sink* s)
+{
+    s3_sink* s3 = (s3_sink*)s;
+    if (s3->buffered != 0 || s3->parts == 0)
+    {
+        s3_flush(s3);
+    }
+    while (s3->active != 0)
+    {
+        s3_wait(s3);
+    }
+
+    size_t size = 128 + (size_t)s3->parts * (64 + S3_ETAG_SIZE);
+    char* xml = sys_realloc(NULL, size);
+    size_t length = (size_t)snprintf(xml, size, "<CompleteMultipartUpload>");
+    for (uint32_t i = 0; i < s3->parts; i++)
+    {
+        length += (size_t)snprintf(xml + length, size - length, "<Part><PartNumber>%u</PartNumber><ETag>%s</ETag></Part>", i + 1, s3->etags[i].value);
+    }
+    length += (size_t)snprintf(xml + length, size - length, "</CompleteMultipartUpload>");
+
+    char query[1024];
+    snprintf(query, sizeof(query), "uploadId=%s", s3->upload_id);
+
+    char date[S3_DATE_SIZE];
+    s3_date(date);
+
+    // server can report error with 200 status, after it has started sending response
+    http_reply reply;
+    s3_request(s3, "POST", query, xml, (uint32_t)length, date, &reply);
+    if (reply.status != 200 || strstr(reply.body, "<Error>") != NULL)
+    {
+        s3_fail("complete upload", &reply);
+    }
+    for (s3_sink** pending = &s3_pending; *pending != NULL; pending = &(*pending)->pending)
+    {
+        if (*pending == s3)
+        {
+            *pending = s3->pending;
+            break;
+        }
+    }
+
+    sys_realloc(xml, 0);
+    sys_realloc(s3->etags, 0);
+    for (uint32_t i = 0; i < S3_MAX_UPLOADS; i++)
+    {
+        if (s3->uploads[i].data)
+        {
+            sys_realloc(s3->uploads[i].data, 0);
+        }
+    }
+    if (s3->buffer)
+    {
+        sys_realloc(s3->buffer, 0);
+    }
+    sys_realloc(s3, 0);
+}
+
+static const sink_vtable s3_vtable =
+{
+    s3_write,
+    NULL,
+    NULL,
+    s3_end,
+};
+
+static void s3_env(const char* name, const char* fallback, char* value, size_t size)
+{
+    const char* env = getenv(name);
+    if (env == NULL || env[0] == 0)
+    {
+        env = fallback;
+    }
+    if (env == NULL)
+    {
+        sys_error("ERROR: %s environment variable is required for upload\n", name);
+    }
+    if (strlen(env) >= size)
+    {
+        sys_error("ERROR: %s environment variable is too long\n", name);
+    }
+    strcpy(value, env);
+}
+
+sink* s3_begin(const char* url)
+{
+    s3_sink* s3 = sys_realloc(NULL, sizeof(*s3));
+    memset(s3, 0, sizeof(*s3));
+
+    // only path style urls are supported: http://host/bucket/key
+    const char* host = url + 7;
+    const char* path = strchr(host, '/');
+    const char* key = path ? strchr(path + 1, '/') : NULL;
+    size_t host_len = path ? (size_t)(path - host) : 0;
+    if (strncmp(url, "http://", 7) != 0 || key == NULL || key[1] == 0 || host_len == 0 || host_len >= sizeof(s3->host))
+    {
+        sys_error("ERROR: upload url must be in http://host/bucket/key form\n");
+    }
+
+    // host header is sent without default port
+    if (host_len > 3 && memcmp(host + host_len - 3, ":80", 3) == 0)
+    {
+        host_len -= 3;
+    }
+    memcpy(s3->host, host, host_len);
+    s3->host[host_len] = 0;
+    s3_encode(path, strlen(path), 1, s3->path, sizeof(s3->path));
+
+    s3_env("AWS_ACCESS_KEY_ID", NULL, s3->access_key, sizeof(s3->access_key));
+    s3_env("AWS_SECRET_ACCESS_KEY", NULL, s3->secret_key, sizeof(s3->secret_key));
+    s3_env("AWS_SESSION_TOKEN", "", s3->token, sizeof(s3->token));
+    s3_env("AWS_REGION", getenv("AWS_DEFAULT_REGION") ? getenv("AWS_DEFAULT_REGION") : "us-east-1", s3->region, sizeof(s3->region));
+
+    char date[S3_DATE_SIZE];
+    s3_date(date);
+
+    http_reply reply;
+    s3_request(s3, "POST", "uploads=", "", 0, date, &reply);
+
+    char upload_id[256];
+    if (reply.status != 200 || !s3_xml_value(reply.body, "UploadId", upload_id, sizeof(upload_id)))
+    {
+        s3_fail("start upload", &reply);
+    }
+    s3_encode(upload_id, strlen(upload_id), 0, s3->upload_id, sizeof(s3->upload_id));
+
+    static int abort_registered;
+    if (!abort_registered)
+    {
+        atexit(s3_abort);
+        abort_registered = 1;
+    }
+    s3->pending = s3_pending;
+    s3_pending = s3;
+
+    s3->part_size = S3_PART_SIZE;
+    s3->buffer = sys_realloc(NULL, s3->part_size);
+    s3->allocated = s3->part_size;
+
+    s3->base.vtable = &s3_vtable;
+    return &s3->base;
+}
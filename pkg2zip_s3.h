@@ -0,0 +1,8 @@
+#pragma once
+
+#include "pkg2zip_sink.h"
+
+// uploads output to S3 compatible server with multipart upload
+// url is http://host[:port]/bucket/key, credentials are taken from AWS_ACCESS_KEY_ID,
+// AWS_SECRET_ACCESS_KEY, optional AWS_SESSION_TOKEN and AWS_REGION environment variables
+sink* s3_begin(const char* url);
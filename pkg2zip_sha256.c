@@ -0,0 +1,174 @@
+#include "pkg2zip_sha256.h"
+
+// https://csrc.nist.gov/publications/detail/fips/180/4/final
+
+static const uint32_t sha256_k[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(uint32_t* state, const uint8_t* block)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+    {
+        w[i] = get32be(block + 4 * i);
+    }
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0];
+    uint32_t b = state[1];
+    uint32_t c = state[2];
+    uint32_t d = state[3];
+    uint32_t e = state[4];
+    uint32_t f = state[5];
+    uint32_t g = state[6];
+    uint32_t h = state[7];
+
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t s1 = ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + sha256_k[i] + w[i];
+        uint32_t s0 = ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+void sha256_init(sha256_ctx* ctx)
+{
+    ctx->state[0] = 0x6a09e667;
+    ctx->state[1] = 0xbb67ae85;
+    ctx->state[2] = 0x3c6ef372;
+    ctx->state[3] = 0xa54ff53a;
+    ctx->state[4] = 0x510e527f;
+    ctx->state[5] = 0x9b05688c;
+    ctx->state[6] = 0x1f83d9ab;
+    ctx->state[7] = 0x5be0cd19;
+    ctx->count = 0;
+}
+
+void sha256_update(sha256_ctx* ctx, const void* buffer, size_t size)
+{
+    const uint8_t* data = buffer;
+    uint32_t used = (uint32_t)(ctx->count % sizeof(ctx->buffer));
+    ctx->count += size;
+
+    if (used != 0)
+    {
+        uint32_t left = (uint32_t)sizeof(ctx->buffer) - used;
+        if (size < left)
+        {
+            memcpy(ctx->buffer + used, data, size);
+            return;
+        }
+        memcpy(ctx->buffer + used, data, left);
+        sha256_block(ctx->state, ctx->buffer);
+        data += left;
+        size -= left;
+    }
+
+    while (size >= sizeof(ctx->buffer))
+    {
+        sha256_block(ctx->state, data);
+        data += sizeof(ctx->buffer);
+        size -= sizeof(ctx->buffer);
+    }
+
+    memcpy(ctx->buffer, data, size);
+}
+
+void sha256_done(sha256_ctx* ctx, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+    uint64_t bits = ctx->count * 8;
+    uint32_t used = (uint32_t)(ctx->count % sizeof(ctx->buffer));
+
+    // padding is 0x80 byte followed by zeros and 64-bit message length in bits
+    ctx->buffer[used++] = 0x80;
+    if (used > sizeof(ctx->buffer) - sizeof(uint64_t))
+    {
+        memset(ctx->buffer + used, 0, sizeof(ctx->buffer) - used);
+        sha256_block(ctx->state, ctx->buffer);
+        used = 0;
+    }
+    memset(ctx->buffer + used, 0, sizeof(ctx->buffer) - sizeof(uint64_t) - used);
+    set64be(ctx->buffer + sizeof(ctx->buffer) - sizeof(uint64_t), bits);
+    sha256_block(ctx->state, ctx->buffer);
+
+    for (int i = 0; i < 8; i++)
+    {
+        set32be(digest + 4 * i, ctx->state[i]);
+    }
+}
+
+void hmac_sha256(const void* key, size_t key_size, const void* data, size_t size, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+    uint8_t block[64] = { 0 };
+    if (key_size > sizeof(block))
+    {
+        sha256_ctx ctx;
+        sha256_init(&ctx);
+        sha256_update(&ctx, key, key_size);
+        sha256_done(&ctx, block);
+    }
+    else
+    {
+        memcpy(block, key, key_size);
+    }
+
+    uint8_t pad[64];
+    for (size_t i = 0; i < sizeof(pad); i++)
+    {
+        pad[i] = block[i] ^ 0x36;
+    }
+
+    uint8_t inner[SHA256_DIGEST_SIZE];
+    sha256_ctx ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, pad, sizeof(pad));
+    sha256_update(&ctx, data, size);
+    sha256_done(&ctx, inner);
+
+    for (size_t i = 0; i < sizeof(pad); i++)
+    {
+        pad[i] = block[i] ^ 0x5c;
+    }
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, pad, sizeof(pad));
+    sha256_update(&ctx, inner, sizeof(inner));
+    sha256_done(&ctx, digest);
+}
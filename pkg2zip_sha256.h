@@ -0,0 +1,17 @@
+#pragma once
+
+#include "pkg2zip_utils.h"
+
+#define SHA256_DIGEST_SIZE 32
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t count;
+    uint8_t buffer[64];
+} sha256_ctx;
+
+void sha256_init(sha256_ctx* ctx);
+void sha256_update(sha256_ctx* ctx, const void* buffer, size_t size);
+void sha256_done(sha256_ctx* ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+void hmac_sha256(const void* key, size_t key_size, const void* data, size_t size, uint8_t digest[SHA256_DIGEST_SIZE]);
@@ -0,0 +1,102 @@
+#include "pkg2zip_sink.h"
+#include "pkg2zip_sys.h"
+#include "pkg2zip_http.h"
+#include "pkg2zip_s3.h"
+
+typedef struct {
+    sink base;
+    sys_file file;
+    uint64_t offset;
+} sink_file;
+
+static void sink_file_write(sink* s, const void* data, uint32_t size)
+{
+    sink_file* f = (sink_file*)s;
+    sys_write(f->file, f->offset, data, size);
+    f->offset += size;
+}
+
+static void sink_file_write_at(sink* s, uint64_t offset, const void* data, uint32_t size)
+{
+    sink_file* f = (sink_file*)s;
+    sys_write(f->file, offset, data, size);
+    if (offset + size > f->offset)
+    {
+        f->offset = offset + size;
+    }
+}
+
+static void sink_file_reserve(sink* s, uint64_t size)
+{
+    sink_file* f = (sink_file*)s;
+    sys_reserve(f->file, size);
+}
+
+static void sink_file_end(sink* s)
+{
+    sink_file* f = (sink_file*)s;
+    sys_close(f->file);
+    sys_realloc(f, 0);
+}
+
+static const sink_vtable sink_file_vtable =
+{
+    sink_file_write,
+    sink_file_write_at,
+    sink_file_reserve,
+    sink_file_end,
+};
+
+static const sink_vtable sink_stream_vtable =
+{
+    sink_file_write,
+    NULL,
+    NULL,
+    sink_file_end,
+};
+
+sink* sink_begin(const char* name)
+{
+    if (http_is_url(name))
+    {
+        return s3_begin(name);
+    }
+
+    sink_file* f = sys_realloc(NULL, sizeof(*f));
+    f->file = sys_create(name);
+    f->offset = 0;
+    f->base.vtable = sys_seekable(f->file) ? &sink_file_vtable : &sink_stream_vtable;
+    return &f->base;
+}
+
+int sink_seekable(sink* s)
+{
+    return s->vtable->write_at != NULL;
+}
+
+void sink_write(sink* s, const void* data, uint32_t size)
+{
+    s->vtable->write(s, data, size);
+}
+
+void sink_write_at(sink* s, uint64_t offset, const void* data, uint32_t size)
+{
+    if (s->vtable->write_at == NULL)
+    {
+        sys_error("ERROR: cannot write at specific offset, output is not seekable\n");
+    }
+    s->vtable->write_at(s, offset, data, size);
+}
+
+void sink_reserve(sink* s, uint64_t size)
+{
+    if (s->vtable->reserve)
+    {
+        s->vtable->reserve(s, size);
+    }
+}
+
+void sink_end(sink* s)
+{
+    s->vtable->end(s);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+// destination where zip or tar file is written to
+
+typedef struct sink sink;
+
+typedef struct {
+    // appends data at end of output
+    void (*write)(sink* s, const void* data, uint32_t size);
+    // writes data at specific offset, NULL when output is not seekable
+    void (*write_at)(sink* s, uint64_t offset, const void* data, uint32_t size);
+    // preallocates space for total size of output, can be NULL
+    void (*reserve)(sink* s, uint64_t size);
+    // finishes output and frees sink
+    void (*end)(sink* s);
+} sink_vtable;
+
+// every sink implementation starts with this struct
+struct sink {
+    const sink_vtable* vtable;
+};
+
+// creates local file, "-" for stdout, or uploads to S3 compatible server when name is http:// url
+sink* sink_begin(const char* name);
+int sink_seekable(sink* s);
+void sink_write(sink* s, const void* data, uint32_t size);
+void sink_write_at(sink* s, uint64_t offset, const void* data, uint32_t size);
+void sink_reserve(sink* s, uint64_t size);
+void sink_end(sink* s);
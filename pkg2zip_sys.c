@@ -1,15 +1,131 @@
 #include "pkg2zip_sys.h"
+#include "pkg2zip_http.h"
 #include "pkg2zip_utils.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <time.h>
+
+static int gOutputStderr;
+
+// how much data to skip at once when seeking forward in stream
+#define SYS_STREAM_SKIP_SIZE (64 * 1024)
+
+// how long to wait for growing file before giving up
+#define SYS_FOLLOW_TIMEOUT 300
+#define SYS_FOLLOW_POLL_MSEC 100
+
+// how long to wait for data from network before giving up
+#define SYS_SOCKET_TIMEOUT 60
+
+// direct i/o bypasses OS cache, file is accessed only in aligned blocks through own buffer
+#define SYS_DIRECT_ALIGN 4096
+#define SYS_DIRECT_BUFFER_SIZE (1024 * 1024)
+
+static int gDirect;
+
+// zero blocks of this size are not written to sparse files
+#define SYS_SPARSE_BLOCK 4096
+
+// how far ahead to prefetch and how much to keep in OS cache behind current position, 0 = no hints
+static uint32_t gCacheWindow;
+
+static struct
+{
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    uint32_t read_calls;
+    uint32_t write_calls;
+    uint64_t ahead_bytes;
+    uint64_t dropped_bytes;
+} gStats;
+
+static void sys_read_stream(sys_file file, uint64_t offset, void* buffer, uint32_t size);
+static void sys_read_follow(sys_file file, uint64_t offset, void* buffer, uint32_t size);
+static void sys_read_direct(sys_file file, uint64_t offset, void* buffer, uint32_t size);
+static void sys_write_direct(sys_file file, uint64_t offset, const void* buffer, uint32_t size);
+static void sys_direct_init(sys_file file, uint64_t size);
+static void sys_direct_done(sys_file file);
+static void sys_truncate(sys_file file, uint64_t size);
+static void sys_write_sparse(sys_file file, uint64_t offset, const void* buffer, uint32_t size);
+static void sys_punch_zeros(sys_file file, const uint8_t* data, uint64_t size);
 
 #if defined(_WIN32)
 
 #define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <ws2tcpip.h>
 #include <windows.h>
+#include <winioctl.h>
+
+#if defined(_MSC_VER)
+#pragma comment (lib, "ws2_32.lib")
+#endif
+
+struct sys_file_data
+{
+    HANDLE handle;
+    HANDLE mapping;
+    int stream;
+    int follow;
+    uint64_t offset;
+
+    // not NULL when reading from http server
+    http http;
+
+    // direct i/o keeps aligned blocks of file in own buffer
+    int direct;
+    int direct_write;
+    uint8_t* direct_memory;
+    uint8_t* direct_buffer;
+    uint64_t direct_offset;
+    uint32_t direct_size;
+    uint64_t direct_end;
+
+    // cache hints are given in windows, these are ends of already hinted ranges
+    uint64_t hint_ahead;
+    uint64_t hint_behind;
+
+    // preallocated size, file is cut to end of written data when closed
+    uint64_t reserved;
+    uint64_t end;
+
+    // whole file mapped in memory for writing
+    void* map;
+    uint64_t map_size;
+
+    int sparse;
+
+    // streams keep data in memory while retain is enabled
+    int retain;
+    uint8_t* retained;
+    uint64_t retained_size;
+    uint64_t retained_allocated;
+};
+
+static sys_file sys_file_new(HANDLE handle, int stream)
+{
+    sys_file file = sys_realloc(NULL, sizeof(*file));
+    file->handle = handle;
+    file->stream = stream;
+    file->follow = 0;
+    file->offset = 0;
+    file->http = NULL;
+    file->direct = 0;
+    file->hint_ahead = 0;
+    file->hint_behind = 0;
+    file->reserved = 0;
+    file->end = 0;
+    file->map = NULL;
+    file->sparse = 0;
+    file->retain = 0;
+    file->retained = NULL;
+    file->retained_size = 0;
+    file->retained_allocated = 0;
+    return file;
+}
 
 static HANDLE gStdout;
 static int gStdoutRedirected;
@@ -30,6 +146,12 @@ void sys_output_done(void)
     SetConsoleOutputCP(gOldCP);
 }
 
+void sys_output_stderr(void)
+{
+    gOutputStderr = 1;
+    gStdoutRedirected = 1;
+}
+
 void sys_output(const char* msg, ...)
 {
     char buffer[1024];
@@ -39,16 +161,19 @@ void sys_output(const char* msg, ...)
     vsnprintf(buffer, sizeof(buffer), msg, arg);
     va_end(arg);
 
-    if (!gStdoutRedirected)
+    HANDLE handle = gOutputStderr ? GetStdHandle(STD_ERROR_HANDLE) : gStdout;
+
+    DWORD mode;
+    if (GetConsoleMode(handle, &mode))
     {
         WCHAR wbuffer[sizeof(buffer)];
         int wcount = MultiByteToWideChar(CP_UTF8, 0, buffer, -1, wbuffer, sizeof(buffer));
 
         DWORD written;
-        WriteConsoleW(GetStdHandle(STD_OUTPUT_HANDLE), wbuffer, wcount - 1, &written, NULL);
+        WriteConsoleW(handle, wbuffer, wcount - 1, &written, NULL);
         return;
     }
-    fputs(buffer, stdout);
+    fputs(buffer, gOutputStderr ? stderr : stdout);
 }
 
 void sys_error(const char* msg, ...)
@@ -94,10 +219,23 @@ static void sys_mkdir_real(const char* path)
 
 sys_file sys_open(const char* fname, uint64_t* size)
 {
+    if (strcmp(fname, "-") == 0)
+    {
+        *size = 0;
+        return sys_file_new(GetStdHandle(STD_INPUT_HANDLE), 1);
+    }
+    if (http_is_url(fname))
+    {
+        sys_file file = sys_file_new(INVALID_HANDLE_VALUE, 0);
+        file->http = http_open(fname, size);
+        return file;
+    }
+
     WCHAR path[MAX_PATH];
     MultiByteToWideChar(CP_UTF8, 0, fname, -1, path, MAX_PATH);
 
-    HANDLE handle = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    DWORD flags = gDirect ? FILE_FLAG_NO_BUFFERING : gCacheWindow ? FILE_FLAG_SEQUENTIAL_SCAN : 0;
+    HANDLE handle = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, flags, NULL);
     if (handle == INVALID_HANDLE_VALUE)
     {
         sys_error("ERROR: cannot open '%s' file\n", fname);
@@ -110,173 +248,1650 @@ sys_file sys_open(const char* fname, uint64_t* size)
     }
     *size = sz.QuadPart;
 
-    return handle;
+    sys_file file = sys_file_new(handle, 0);
+    if (gDirect)
+    {
+        sys_direct_init(file, *size);
+    }
+    return file;
 }
 
 sys_file sys_create(const char* fname)
 {
+    if (strcmp(fname, "-") == 0)
+    {
+        return sys_file_new(GetStdHandle(STD_OUTPUT_HANDLE), 1);
+    }
+
     WCHAR path[MAX_PATH];
     MultiByteToWideChar(CP_UTF8, 0, fname, -1, path, MAX_PATH);
 
-    HANDLE handle = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+    DWORD flags = gDirect ? FILE_FLAG_NO_BUFFERING : 0;
+    HANDLE handle = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, flags, NULL);
     if (handle == INVALID_HANDLE_VALUE)
     {
         sys_error("ERROR: cannot create '%s' file\n", fname);
     }
 
-    return handle;
+    sys_file file = sys_file_new(handle, 0);
+    if (gDirect)
+    {
+        sys_direct_init(file, 0);
+        file->direct_write = 1;
+    }
+    return file;
+}
+
+void sys_rename(const char* from, const char* to)
+{
+    WCHAR wfrom[MAX_PATH];
+    WCHAR wto[MAX_PATH];
+    MultiByteToWideChar(CP_UTF8, 0, from, -1, wfrom, MAX_PATH);
+    MultiByteToWideChar(CP_UTF8, 0, to, -1, wto, MAX_PATH);
+
+    if (!MoveFileExW(wfrom, wto, MOVEFILE_REPLACE_EXISTING))
+    {
+        sys_error("ERROR: cannot rename '%s' to '%s'\n", from, to);
+    }
 }
 
 void sys_close(sys_file file)
 {
-    if (!CloseHandle(file))
+    if (file->map)
+    {
+        if (file->sparse)
+        {
+            sys_punch_zeros(file, file->map, file->map_size);
+        }
+        UnmapViewOfFile(file->map);
+        CloseHandle(file->mapping);
+    }
+
+    if (file->direct)
+    {
+        sys_direct_done(file);
+    }
+    else if (file->reserved > file->end || file->sparse)
+    {
+        // sparse file may end with zeros that were not written
+        sys_truncate(file, file->end);
+    }
+
+    if (file->http)
+    {
+        http_close(file->http);
+    }
+    else if (file->stream)
+    {
+        if (!FlushFileBuffers(file->handle) && GetLastError() != ERROR_INVALID_HANDLE)
+        {
+            sys_error("ERROR: failed to flush output stream\n");
+        }
+    }
+    else if (!CloseHandle(file->handle))
     {
         sys_error("ERROR: failed to close file\n");
     }
+    if (file->retained)
+    {
+        sys_realloc(file->retained, 0);
+    }
+    sys_realloc(file, 0);
 }
 
-void sys_read(sys_file file, uint64_t offset, void* buffer, uint32_t size)
+static void sys_read_next(sys_file file, void* buffer, uint32_t size)
+{
+    uint8_t* data = buffer;
+    while (size != 0)
+    {
+        DWORD read;
+        if (!ReadFile(file->handle, data, size, &read, NULL) || read == 0)
+        {
+            sys_error("ERROR: failed to read %u bytes from input stream\n", size);
+        }
+        data += read;
+        size -= read;
+    }
+}
+
+static uint32_t sys_read_some(sys_file file, uint64_t offset, void* buffer, uint32_t size)
 {
     DWORD read;
     OVERLAPPED ov;
     ov.hEvent = NULL;
     ov.Offset = (uint32_t)offset;
     ov.OffsetHigh = (uint32_t)(offset >> 32);
-    if (!ReadFile(file, buffer, size, &read, &ov) || read != size)
+    if (!ReadFile(file->handle, buffer, size, &read, &ov))
     {
-        sys_error("ERROR: failed to read %u bytes from file\n", size);
+        if (GetLastError() != ERROR_HANDLE_EOF)
+        {
+            sys_error("ERROR: failed to read %u bytes from file\n", size);
+        }
+        read = 0;
     }
+    return read;
 }
 
-void sys_write(sys_file file, uint64_t offset, const void* buffer, uint32_t size)
+static void sys_write_all(sys_file file, uint64_t offset, const void* buffer, uint32_t size)
 {
     DWORD written;
     OVERLAPPED ov;
     ov.hEvent = NULL;
     ov.Offset = (uint32_t)offset;
     ov.OffsetHigh = (uint32_t)(offset >> 32);
-    if (!WriteFile(file, buffer, size, &written, &ov) || written != size)
+    if (!WriteFile(file->handle, buffer, size, &written, &ov) || written != size)
     {
         sys_error("ERROR: failed to write %u bytes to file\n", size);
     }
 }
 
-#else
+static void sys_truncate(sys_file file, uint64_t size)
+{
+    FILE_END_OF_FILE_INFO info;
+    info.EndOfFile.QuadPart = size;
+    if (!SetFileInformationByHandle(file->handle, FileEndOfFileInfo, &info, sizeof(info)))
+    {
+        sys_error("ERROR: failed to set file size\n");
+    }
+}
 
-#define _FILE_OFFSET_BITS 64
-#include <stdio.h>
-#include <fcntl.h>
-#include <errno.h>
-#include <unistd.h>
-#include <sys/stat.h>
+int sys_reserve(sys_file file, uint64_t size)
+{
+    if (file->stream)
+    {
+        return 0;
+    }
+    if (size <= file->reserved)
+    {
+        return 1;
+    }
 
-static int gStdoutRedirected;
+    // allocation is only a hint for writing, failure matters only for mapping
+    FILE_ALLOCATION_INFO info;
+    info.AllocationSize.QuadPart = size;
+    if (!SetFileInformationByHandle(file->handle, FileAllocationInfo, &info, sizeof(info)))
+    {
+        return 0;
+    }
+    file->reserved = size;
+    return 1;
+}
 
-void sys_output_init(void)
+void* sys_map(sys_file file, uint64_t size)
 {
-    gStdoutRedirected = !isatty(STDOUT_FILENO);
+    if (file->stream || file->direct || file->map || size == 0 || size > (SIZE_T)-1)
+    {
+        return NULL;
+    }
+    // without reserved space writing to mapping on full disk would fail with exception
+    if (!sys_reserve(file, size))
+    {
+        return NULL;
+    }
+
+    // mapping sets file size
+    HANDLE mapping = CreateFileMappingW(file->handle, NULL, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, NULL);
+    if (mapping == NULL)
+    {
+        return NULL;
+    }
+    void* ptr = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, (SIZE_T)size);
+    if (ptr == NULL)
+    {
+        CloseHandle(mapping);
+        return NULL;
+    }
+
+    file->mapping = mapping;
+    file->map = ptr;
+    file->map_size = size;
+    if (size > file->end)
+    {
+        file->end = size;
+    }
+    gStats.write_bytes += size;
+    return ptr;
 }
 
-void sys_output_done(void)
+void sys_sparse(sys_file file)
 {
+    DWORD bytes;
+    if (!file->stream && DeviceIoControl(file->handle, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &bytes, NULL))
+    {
+        file->sparse = 1;
+    }
 }
 
-void sys_output(const char* msg, ...)
+static void sys_punch(sys_file file, uint64_t offset, uint64_t size)
 {
-    va_list arg;
-    va_start(arg, msg);
-    vfprintf(stdout, msg, arg);
-    va_end(arg);
+    FILE_ZERO_DATA_INFORMATION zero;
+    zero.FileOffset.QuadPart = offset;
+    zero.BeyondFinalZero.QuadPart = offset + size;
+
+    DWORD bytes;
+    DeviceIoControl(file->handle, FSCTL_SET_ZERO_DATA, &zero, sizeof(zero), NULL, 0, &bytes, NULL);
 }
 
-void sys_error(const char* msg, ...)
+// Windows has no per range cache hints, only sequential scan flag when opening file
+static void sys_hint_read(sys_file file, uint64_t offset, uint32_t size)
 {
-    va_list arg;
-    va_start(arg, msg);
-    vfprintf(stderr, msg, arg);
-    va_end(arg);
+    (void)file;
+    (void)offset;
+    (void)size;
+}
 
-    exit(EXIT_FAILURE);
+static void sys_hint_write(sys_file file, uint64_t offset, uint32_t size)
+{
+    (void)file;
+    (void)offset;
+    (void)size;
 }
 
-static void sys_mkdir_real(const char* path)
+static void sys_sleep(uint32_t msec)
+{
+    Sleep(msec);
+}
+
+void sys_read(sys_file file, uint64_t offset, void* buffer, uint32_t size)
 {
-    if (mkdir(path, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) < 0)
+    gStats.read_calls++;
+    gStats.read_bytes += size;
+
+    if (file->http)
     {
-        if (errno != EEXIST)
-        {
-            sys_error("ERROR: cannot create '%s' folder\n", path);
-        }
+        http_read(file->http, offset, buffer, size);
+        return;
+    }
+    if (file->stream)
+    {
+        sys_read_stream(file, offset, buffer, size);
+        return;
+    }
+    if (file->direct)
+    {
+        sys_read_direct(file, offset, buffer, size);
+        return;
+    }
+    if (file->follow)
+    {
+        sys_read_follow(file, offset, buffer, size);
+        return;
+    }
+
+    DWORD read;
+    OVERLAPPED ov;
+    ov.hEvent = NULL;
+    ov.Offset = (uint32_t)offset;
+    ov.OffsetHigh = (uint32_t)(offset >> 32);
+    if (!ReadFile(file->handle, buffer, size, &read, &ov) || read != size)
+    {
+        sys_error("ERROR: failed to read %u bytes from file\n", size);
     }
+    sys_hint_read(file, offset, size);
 }
 
-sys_file sys_open(const char* fname, uint64_t* size)
+void sys_write(sys_file file, uint64_t offset, const void* buffer, uint32_t size)
 {
-    int fd = open(fname, O_RDONLY);
-    if (fd < 0)
+    gStats.write_calls++;
+    gStats.write_bytes += size;
+    int fresh = offset >= file->end;
+    if (offset + size > file->end)
     {
-        sys_error("ERROR: cannot open '%s' file\n", fname);
+        file->end = offset + size;
     }
 
-    struct stat st;
-    if (fstat(fd, &st) != 0)
+    if (file->stream)
     {
-        sys_error("ERROR: cannot get size of '%s' file\n", fname);
+        if (offset != file->offset)
+        {
+            sys_error("ERROR: cannot seek in output stream\n");
+        }
+        DWORD written;
+        if (!WriteFile(file->handle, buffer, size, &written, NULL) || written != size)
+        {
+            sys_error("ERROR: failed to write %u bytes to output stream\n", size);
+        }
+        file->offset += size;
+        return;
+    }
+    if (file->direct)
+    {
+        sys_write_direct(file, offset, buffer, size);
+        return;
+    }
+    if (file->sparse && fresh)
+    {
+        sys_write_sparse(file, offset, buffer, size);
+        return;
     }
-    *size = st.st_size;
 
-    return (void*)(intptr_t)fd;
+    sys_write_all(file, offset, buffer, size);
+    sys_hint_write(file, offset, size);
 }
 
-sys_file sys_create(const char* fname)
+struct sys_socket_data
 {
-    int fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-    if (fd < 0)
+    SOCKET socket;
+};
+
+sys_socket sys_connect(const char* host, const char* port)
+{
+    static int initialized;
+    if (!initialized)
     {
-        sys_error("ERROR: cannot create '%s' file\n", fname);
+        WSADATA wsa;
+        if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+        {
+            return NULL;
+        }
+        initialized = 1;
     }
 
-    return (void*)(intptr_t)fd;
-}
+    struct addrinfo hints = { 0 };
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
 
-void sys_close(sys_file file)
-{
-    if (close((int)(intptr_t)file) != 0)
+    struct addrinfo* list;
+    if (getaddrinfo(host, port, &hints, &list) != 0)
     {
-        sys_error("ERROR: failed to close file\n");
+        return NULL;
+    }
+
+    SOCKET s = INVALID_SOCKET;
+    for (struct addrinfo* addr = list; addr; addr = addr->ai_next)
+    {
+        s = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+        if (s == INVALID_SOCKET)
+        {
+            continue;
+        }
+        if (connect(s, addr->ai_addr, (int)addr->ai_addrlen) == 0)
+        {
+            break;
+        }
+        closesocket(s);
+        s = INVALID_SOCKET;
     }
+    freeaddrinfo(list);
+
+    if (s == INVALID_SOCKET)
+    {
+        return NULL;
+    }
+
+    DWORD timeout = SYS_SOCKET_TIMEOUT * 1000;
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+
+    sys_socket sock = sys_realloc(NULL, sizeof(*sock));
+    sock->socket = s;
+    return sock;
 }
 
-void sys_read(sys_file file, uint64_t offset, void* buffer, uint32_t size)
+void sys_disconnect(sys_socket sock)
 {
-    ssize_t read = pread((int)(intptr_t)file, buffer, size, offset);
-    if (read < 0 || read != (ssize_t)size)
+    closesocket(sock->socket);
+    sys_realloc(sock, 0);
+}
+
+int sys_send(sys_socket sock, const void* buffer, uint32_t size)
+{
+    const char* data = buffer;
+    while (size != 0)
     {
-        sys_error("ERROR: failed to read %u bytes from file\n", size);
+        int sent = send(sock->socket, data, (int)size, 0);
+        if (sent <= 0)
+        {
+            return 0;
+        }
+        data += sent;
+        size -= (uint32_t)sent;
     }
+    return 1;
 }
 
-void sys_write(sys_file file, uint64_t offset, const void* buffer, uint32_t size)
+int sys_recv(sys_socket sock, void* buffer, uint32_t size)
 {
-    ssize_t wrote = pwrite((int)(intptr_t)file, buffer, size, offset);
-    if (wrote < 0 || wrote != (ssize_t)size)
+    int got = recv(sock->socket, buffer, (int)size, 0);
+    return got < 0 ? -1 : got;
+}
+
+struct sys_thread_data
+{
+    HANDLE handle;
+    sys_thread_func* func;
+    void* arg;
+};
+
+static DWORD WINAPI sys_thread_proc(LPVOID param)
+{
+    sys_thread thread = param;
+    thread->func(thread->arg);
+    return 0;
+}
+
+uint32_t sys_cpu_count(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+}
+
+sys_thread sys_thread_start(sys_thread_func* func, void* arg)
+{
+    sys_thread thread = sys_realloc(NULL, sizeof(*thread));
+    thread->func = func;
+    thread->arg = arg;
+    thread->handle = CreateThread(NULL, 0, sys_thread_proc, thread, 0, NULL);
+    if (thread->handle == NULL)
     {
-        sys_error("ERROR: failed to read %u bytes from file\n", size);
+        sys_error("ERROR: cannot create thread\n");
     }
+    return thread;
 }
 
+void sys_thread_join(sys_thread thread)
+{
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+    sys_realloc(thread, 0);
+}
+
+#else
+
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <pthread.h>
+
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
 #endif
 
-void sys_mkdir(const char* path)
+// macOS does not have O_DIRECT, F_NOCACHE is used instead
+#if !defined(O_DIRECT)
+#define O_DIRECT 0
+#endif
+
+struct sys_file_data
 {
-    char* last = strrchr(path, '/');
-    if (last)
-    {
-        *last = 0;
-        sys_mkdir(path);
-        *last = '/';
+    int fd;
+    int stream;
+    int follow;
+    uint64_t offset;
+
+    // not NULL when reading from http server
+    http http;
+
+    // direct i/o keeps aligned blocks of file in own buffer
+    int direct;
+    int direct_write;
+    uint8_t* direct_memory;
+    uint8_t* direct_buffer;
+    uint64_t direct_offset;
+    uint32_t direct_size;
+    uint64_t direct_end;
+
+    // cache hints are given in windows, these are ends of already hinted ranges
+    uint64_t hint_ahead;
+    uint64_t hint_behind;
+
+    // preallocated size, file is cut to end of written data when closed
+    uint64_t reserved;
+    uint64_t end;
+
+    // whole file mapped in memory for writing
+    void* map;
+    uint64_t map_size;
+
+    int sparse;
+
+    // streams keep data in memory while retain is enabled
+    int retain;
+    uint8_t* retained;
+    uint64_t retained_size;
+    uint64_t retained_allocated;
+};
+
+static sys_file sys_file_new(int fd, int stream)
+{
+    sys_file file = sys_realloc(NULL, sizeof(*file));
+    file->fd = fd;
+    file->stream = stream;
+    file->follow = 0;
+    file->offset = 0;
+    file->http = NULL;
+    file->direct = 0;
+    file->hint_ahead = 0;
+    file->hint_behind = 0;
+    file->reserved = 0;
+    file->end = 0;
+    file->map = NULL;
+    file->sparse = 0;
+    file->retain = 0;
+    file->retained = NULL;
+    file->retained_size = 0;
+    file->retained_allocated = 0;
+    return file;
+}
+
+static int gStdoutRedirected;
+
+void sys_output_init(void)
+{
+    gStdoutRedirected = !isatty(STDOUT_FILENO);
+}
+
+void sys_output_done(void)
+{
+}
+
+void sys_output_stderr(void)
+{
+    gOutputStderr = 1;
+    gStdoutRedirected = 1;
+}
+
+void sys_output(const char* msg, ...)
+{
+    va_list arg;
+    va_start(arg, msg);
+    vfprintf(gOutputStderr ? stderr : stdout, msg, arg);
+    va_end(arg);
+}
+
+void sys_error(const char* msg, ...)
+{
+    va_list arg;
+    va_start(arg, msg);
+    vfprintf(stderr, msg, arg);
+    va_end(arg);
+
+    exit(EXIT_FAILURE);
+}
+
+// recently used folders stay open, so files and folders are created relative to them
+#define SYS_FOLDER_FDS 64
+#define SYS_FOLDER_PATH 1024
+
+typedef struct {
+    int fd;
+    uint32_t used; // 0 = entry is empty
+    char path[SYS_FOLDER_PATH];
+} sys_folder_fd;
+
+static sys_folder_fd gFolderFds[SYS_FOLDER_FDS];
+static uint32_t gFolderClock;
+
+// returns -1 if folder is not open
+static int sys_folder_cached(const char* path, size_t length)
+{
+    for (uint32_t i = 0; i < SYS_FOLDER_FDS; i++)
+    {
+        sys_folder_fd* entry = gFolderFds + i;
+        if (entry->used && strncmp(entry->path, path, length) == 0 && entry->path[length] == 0)
+        {
+            entry->used = ++gFolderClock;
+            return entry->fd;
+        }
+    }
+    return -1;
+}
+
+// least recently used folder is closed when table is full
+static void sys_folder_keep(const char* path, size_t length, int fd)
+{
+    sys_folder_fd* entry = gFolderFds;
+    for (uint32_t i = 0; i < SYS_FOLDER_FDS; i++)
+    {
+        if (!gFolderFds[i].used)
+        {
+            entry = gFolderFds + i;
+            break;
+        }
+        if (gFolderFds[i].used < entry->used)
+        {
+            entry = gFolderFds + i;
+        }
+    }
+
+    if (entry->used)
+    {
+        close(entry->fd);
+    }
+    entry->fd = fd;
+    entry->used = ++gFolderClock;
+    memcpy(entry->path, path, length);
+    entry->path[length] = 0;
+}
+
+// returns fd of parent folder and name relative to it, parent is opened relative to its own parent if needed
+static int sys_folder_parent(const char* path, const char** name)
+{
+    *name = path;
+    const char* last = strrchr(path, '/');
+    if (last == NULL || last == path || (size_t)(last - path) >= SYS_FOLDER_PATH)
+    {
+        return AT_FDCWD;
+    }
+
+    size_t length = last - path;
+    int fd = sys_folder_cached(path, length);
+    if (fd < 0)
+    {
+        char folder[SYS_FOLDER_PATH];
+        memcpy(folder, path, length);
+        folder[length] = 0;
+
+        const char* folder_name;
+        int dir = sys_folder_parent(folder, &folder_name);
+        fd = openat(dir, folder_name, O_RDONLY | O_DIRECTORY);
+        if (fd < 0)
+        {
+            return AT_FDCWD;
+        }
+        sys_folder_keep(folder, length, fd);
+    }
+
+    *name = last + 1;
+    return fd;
+}
+
+static void sys_mkdir_real(const char* path)
+{
+    const char* name;
+    int dir = sys_folder_parent(path, &name);
+
+    if (mkdirat(dir, name, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) < 0)
+    {
+        if (errno != EEXIST)
+        {
+            sys_error("ERROR: cannot create '%s' folder\n", path);
+        }
+    }
+
+    // files are created in new folder next, so it is opened right away
+    size_t length = strlen(path);
+    if (length < SYS_FOLDER_PATH)
+    {
+        int fd = openat(dir, name, O_RDONLY | O_DIRECTORY);
+        if (fd >= 0)
+        {
+            sys_folder_keep(path, length, fd);
+        }
+    }
+}
+
+sys_file sys_open(const char* fname, uint64_t* size)
+{
+    if (strcmp(fname, "-") == 0)
+    {
+        *size = 0;
+        return sys_file_new(STDIN_FILENO, 1);
+    }
+    if (http_is_url(fname))
+    {
+        sys_file file = sys_file_new(-1, 0);
+        file->http = http_open(fname, size);
+        return file;
+    }
+
+    int fd = open(fname, O_RDONLY | (gDirect ? O_DIRECT : 0));
+    if (fd < 0 && gDirect && errno == EINVAL)
+    {
+        // file system does not support direct i/o
+        fd = open(fname, O_RDONLY);
+    }
+    if (fd < 0)
+    {
+        sys_error("ERROR: cannot open '%s' file\n", fname);
+    }
+#if defined(POSIX_FADV_SEQUENTIAL)
+    if (gCacheWindow)
+    {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+#endif
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        sys_error("ERROR: cannot get size of '%s' file\n", fname);
+    }
+    *size = st.st_size;
+
+    sys_file file = sys_file_new(fd, 0);
+    if (gDirect)
+    {
+#if defined(F_NOCACHE)
+        fcntl(fd, F_NOCACHE, 1);
+#endif
+        sys_direct_init(file, *size);
+    }
+    return file;
+}
+
+sys_file sys_create(const char* fname)
+{
+    if (strcmp(fname, "-") == 0)
+    {
+        return sys_file_new(STDOUT_FILENO, 1);
+    }
+
+    // file is created relative to its folder, so only last path component is resolved
+    const char* base;
+    int dir = sys_folder_parent(fname, &base);
+
+    int flags = O_RDWR | O_CREAT | O_TRUNC;
+    int mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+    int fd = openat(dir, base, flags | (gDirect ? O_DIRECT : 0), mode);
+    if (fd < 0 && gDirect && errno == EINVAL)
+    {
+        fd = openat(dir, base, flags, mode);
+    }
+    if (fd < 0)
+    {
+        sys_error("ERROR: cannot create '%s' file\n", fname);
+    }
+
+    sys_file file = sys_file_new(fd, 0);
+    if (gDirect)
+    {
+#if defined(F_NOCACHE)
+        fcntl(fd, F_NOCACHE, 1);
+#endif
+        sys_direct_init(file, 0);
+        file->direct_write = 1;
+    }
+    return file;
+}
+
+void sys_rename(const char* from, const char* to)
+{
+    if (rename(from, to) < 0)
+    {
+        sys_error("ERROR: cannot rename '%s' to '%s'\n", from, to);
+    }
+}
+
+void sys_close(sys_file file)
+{
+    if (file->map)
+    {
+        if (file->sparse)
+        {
+            sys_punch_zeros(file, file->map, file->map_size);
+        }
+        munmap(file->map, (size_t)file->map_size);
+    }
+
+    if (file->direct)
+    {
+        sys_direct_done(file);
+    }
+    else if (file->reserved > file->end || file->sparse)
+    {
+        // sparse file may end with zeros that were not written
+        sys_truncate(file, file->end);
+    }
+
+    if (file->http)
+    {
+        http_close(file->http);
+    }
+    else if (!file->stream && close(file->fd) != 0)
+    {
+        sys_error("ERROR: failed to close file\n");
+    }
+    if (file->retained)
+    {
+        sys_realloc(file->retained, 0);
+    }
+    sys_realloc(file, 0);
+}
+
+static void sys_read_next(sys_file file, void* buffer, uint32_t size)
+{
+    uint8_t* data = buffer;
+    while (size != 0)
+    {
+        ssize_t got = read(file->fd, data, size);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            sys_error("ERROR: failed to read %u bytes from input stream\n", size);
+        }
+        data += got;
+        size -= (uint32_t)got;
+    }
+}
+
+static uint32_t sys_read_some(sys_file file, uint64_t offset, void* buffer, uint32_t size)
+{
+    ssize_t got;
+    do
+    {
+        got = pread(file->fd, buffer, size, offset);
+    }
+    while (got < 0 && errno == EINTR);
+
+    if (got < 0)
+    {
+        sys_error("ERROR: failed to read %u bytes from file\n", size);
+    }
+    return (uint32_t)got;
+}
+
+static void sys_write_all(sys_file file, uint64_t offset, const void* buffer, uint32_t size)
+{
+    ssize_t wrote = pwrite(file->fd, buffer, size, offset);
+    if (wrote < 0 || wrote != (ssize_t)size)
+    {
+        sys_error("ERROR: failed to write %u bytes to file\n", size);
+    }
+}
+
+static void sys_truncate(sys_file file, uint64_t size)
+{
+    if (ftruncate(file->fd, size) != 0)
+    {
+        sys_error("ERROR: failed to set file size\n");
+    }
+}
+
+int sys_reserve(sys_file file, uint64_t size)
+{
+    if (file->stream)
+    {
+        return 0;
+    }
+    if (size <= file->reserved)
+    {
+        return 1;
+    }
+
+    // allocation is only a hint for writing, failure matters only for mapping
+#if defined(__linux__)
+    if (fallocate(file->fd, 0, file->reserved, size - file->reserved) != 0)
+    {
+        return 0;
+    }
+#elif defined(F_PREALLOCATE)
+    fstore_t store = { F_ALLOCATECONTIG | F_ALLOCATEALL, F_PEOFPOSMODE, 0, size - file->reserved, 0 };
+    if (fcntl(file->fd, F_PREALLOCATE, &store) < 0)
+    {
+        store.fst_flags = F_ALLOCATEALL;
+        if (fcntl(file->fd, F_PREALLOCATE, &store) < 0)
+        {
+            return 0;
+        }
+    }
+#else
+    return 0;
+#endif
+    file->reserved = size;
+    return 1;
+}
+
+void* sys_map(sys_file file, uint64_t size)
+{
+    if (file->stream || file->direct || file->map || size == 0 || size > (size_t)-1)
+    {
+        return NULL;
+    }
+
+    // space is allocated first, so writing to mapping cannot fail with SIGBUS on full disk
+    if (!sys_reserve(file, size) || ftruncate(file->fd, size) != 0)
+    {
+        return NULL;
+    }
+
+    void* ptr = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+    if (ptr == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    file->map = ptr;
+    file->map_size = size;
+    if (size > file->end)
+    {
+        file->end = size;
+    }
+    gStats.write_bytes += size;
+    return ptr;
+}
+
+void sys_sparse(sys_file file)
+{
+    if (!file->stream)
+    {
+        file->sparse = 1;
+    }
+}
+
+static void sys_punch(sys_file file, uint64_t offset, uint64_t size)
+{
+    // punching only releases space, unwritten or preallocated blocks are read as zeros anyway
+#if defined(FALLOC_FL_PUNCH_HOLE)
+    fallocate(file->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, size);
+#elif defined(F_PUNCHHOLE)
+    fpunchhole_t punch = { 0, 0, offset, size };
+    fcntl(file->fd, F_PUNCHHOLE, &punch);
+#else
+    (void)file;
+    (void)offset;
+    (void)size;
+#endif
+}
+
+static void sys_hint_read(sys_file file, uint64_t offset, uint32_t size)
+{
+    if (gCacheWindow == 0)
+    {
+        return;
+    }
+
+    uint64_t end = offset + size;
+    if (offset < file->hint_behind || offset > file->hint_ahead)
+    {
+        // jumped outside of hinted range, start hinting again from here
+        file->hint_ahead = end;
+        file->hint_behind = offset;
+    }
+
+#if defined(POSIX_FADV_WILLNEED)
+    // request next window when only half of current one is left
+    if (end + gCacheWindow / 2 > file->hint_ahead)
+    {
+        uint64_t from = file->hint_ahead > end ? file->hint_ahead : end;
+        uint64_t to = end + gCacheWindow;
+        posix_fadvise(file->fd, from, to - from, POSIX_FADV_WILLNEED);
+        gStats.ahead_bytes += to - from;
+        file->hint_ahead = to;
+    }
+
+    // pkg data behind current position is already processed
+    if (offset >= file->hint_behind + gCacheWindow)
+    {
+        posix_fadvise(file->fd, file->hint_behind, offset - file->hint_behind, POSIX_FADV_DONTNEED);
+        gStats.dropped_bytes += offset - file->hint_behind;
+        file->hint_behind = offset;
+    }
+#endif
+}
+
+static void sys_hint_write(sys_file file, uint64_t offset, uint32_t size)
+{
+    uint64_t end = offset + size;
+    if (gCacheWindow == 0 || end < file->hint_ahead + gCacheWindow)
+    {
+        return;
+    }
+
+    // dirty pages cannot be dropped, so previous window must be written first
+    // writeback of current window is only started to not wait for it here
+    uint64_t behind = file->hint_ahead - file->hint_behind;
+#if defined(SYNC_FILE_RANGE_WRITE)
+    if (behind != 0)
+    {
+        sync_file_range(file->fd, file->hint_behind, behind, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    }
+    sync_file_range(file->fd, file->hint_ahead, end - file->hint_ahead, SYNC_FILE_RANGE_WRITE);
+#endif
+#if defined(POSIX_FADV_DONTNEED)
+    if (behind != 0)
+    {
+        posix_fadvise(file->fd, file->hint_behind, behind, POSIX_FADV_DONTNEED);
+        gStats.dropped_bytes += behind;
+    }
+#endif
+    file->hint_behind = file->hint_ahead;
+    file->hint_ahead = end;
+}
+
+static void sys_sleep(uint32_t msec)
+{
+    struct timespec ts;
+    ts.tv_sec = msec / 1000;
+    ts.tv_nsec = (msec % 1000) * 1000000;
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+    {
+    }
+}
+
+void sys_read(sys_file file, uint64_t offset, void* buffer, uint32_t size)
+{
+    gStats.read_calls++;
+    gStats.read_bytes += size;
+
+    if (file->http)
+    {
+        http_read(file->http, offset, buffer, size);
+        return;
+    }
+    if (file->stream)
+    {
+        sys_read_stream(file, offset, buffer, size);
+        return;
+    }
+    if (file->direct)
+    {
+        sys_read_direct(file, offset, buffer, size);
+        return;
+    }
+    if (file->follow)
+    {
+        sys_read_follow(file, offset, buffer, size);
+        return;
+    }
+
+    ssize_t read = pread(file->fd, buffer, size, offset);
+    if (read < 0 || read != (ssize_t)size)
+    {
+        sys_error("ERROR: failed to read %u bytes from file\n", size);
+    }
+    sys_hint_read(file, offset, size);
+}
+
+void sys_write(sys_file file, uint64_t offset, const void* buffer, uint32_t size)
+{
+    gStats.write_calls++;
+    gStats.write_bytes += size;
+    int fresh = offset >= file->end;
+    if (offset + size > file->end)
+    {
+        file->end = offset + size;
+    }
+
+    if (file->stream)
+    {
+        if (offset != file->offset)
+        {
+            sys_error("ERROR: cannot seek in output stream\n");
+        }
+
+        const uint8_t* data = buffer;
+        uint32_t left = size;
+        while (left != 0)
+        {
+            ssize_t wrote = write(file->fd, data, left);
+            if (wrote < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (wrote <= 0)
+            {
+                sys_error("ERROR: failed to write %u bytes to output stream\n", size);
+            }
+            data += wrote;
+            left -= (uint32_t)wrote;
+        }
+        file->offset += size;
+        return;
+    }
+    if (file->direct)
+    {
+        sys_write_direct(file, offset, buffer, size);
+        return;
+    }
+    if (file->sparse && fresh)
+    {
+        sys_write_sparse(file, offset, buffer, size);
+        return;
+    }
+
+    sys_write_all(file, offset, buffer, size);
+    sys_hint_write(file, offset, size);
+}
+
+struct sys_socket_data
+{
+    int fd;
+};
+
+sys_socket sys_connect(const char* host, const char* port)
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo* list;
+    if (getaddrinfo(host, port, &hints, &list) != 0)
+    {
+        return NULL;
+    }
+
+    int fd = -1;
+    for (struct addrinfo* addr = list; addr; addr = addr->ai_next)
+    {
+        fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+        if (fd < 0)
+        {
+            continue;
+        }
+        if (connect(fd, addr->ai_addr, addr->ai_addrlen) == 0)
+        {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(list);
+
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    struct timeval timeout;
+    timeout.tv_sec = SYS_SOCKET_TIMEOUT;
+    timeout.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+#if defined(SO_NOSIGPIPE)
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+    sys_socket sock = sys_realloc(NULL, sizeof(*sock));
+    sock->fd = fd;
+    return sock;
+}
+
+void sys_disconnect(sys_socket sock)
+{
+    close(sock->fd);
+    sys_realloc(sock, 0);
+}
+
+int sys_send(sys_socket sock, const void* buffer, uint32_t size)
+{
+    const uint8_t* data = buffer;
+    while (size != 0)
+    {
+        ssize_t sent = send(sock->fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return 0;
+        }
+        data += sent;
+        size -= (uint32_t)sent;
+    }
+    return 1;
+}
+
+int sys_recv(sys_socket sock, void* buffer, uint32_t size)
+{
+    ssize_t got;
+    do
+    {
+        got = recv(sock->fd, buffer, size, 0);
+    }
+    while (got < 0 && errno == EINTR);
+
+    return got < 0 ? -1 : (int)got;
+}
+
+struct sys_thread_data
+{
+    pthread_t handle;
+    sys_thread_func* func;
+    void* arg;
+};
+
+static void* sys_thread_proc(void* param)
+{
+    sys_thread thread = param;
+    thread->func(thread->arg);
+    return NULL;
+}
+
+uint32_t sys_cpu_count(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (uint32_t)count : 1;
+}
+
+sys_thread sys_thread_start(sys_thread_func* func, void* arg)
+{
+    sys_thread thread = sys_realloc(NULL, sizeof(*thread));
+    thread->func = func;
+    thread->arg = arg;
+    if (pthread_create(&thread->handle, NULL, sys_thread_proc, thread) != 0)
+    {
+        sys_error("ERROR: cannot create thread\n");
+    }
+    return thread;
+}
+
+void sys_thread_join(sys_thread thread)
+{
+    pthread_join(thread->handle, NULL);
+    sys_realloc(thread, 0);
+}
+
+#endif
+
+void sys_direct_io(void)
+{
+    gDirect = 1;
+}
+
+void sys_cache_window(uint32_t size)
+{
+    gCacheWindow = size;
+}
+
+void sys_output_stats(void)
+{
+    sys_output("[*] read %.1f MB in %u calls, written %.1f MB in %u calls\n",
+        gStats.read_bytes / 1048576.0, gStats.read_calls,
+        gStats.write_bytes / 1048576.0, gStats.write_calls);
+    sys_output("[*] cache hints: read ahead %.1f MB, dropped %.1f MB\n",
+        gStats.ahead_bytes / 1048576.0, gStats.dropped_bytes / 1048576.0);
+}
+
+static void sys_direct_init(sys_file file, uint64_t size)
+{
+    // one extra block for alignment and one for reading last partial block
+    file->direct_memory = sys_realloc(NULL, SYS_DIRECT_BUFFER_SIZE + 2 * SYS_DIRECT_ALIGN);
+    file->direct_buffer = (uint8_t*)(((uintptr_t)file->direct_memory + SYS_DIRECT_ALIGN - 1) & ~(uintptr_t)(SYS_DIRECT_ALIGN - 1));
+    file->direct_offset = 0;
+    file->direct_size = 0;
+    file->direct_end = size;
+    file->direct_write = 0;
+    file->direct = 1;
+}
+
+static void sys_direct_flush(sys_file file)
+{
+    uint32_t used = file->direct_size;
+    if (used == 0)
+    {
+        return;
+    }
+
+    uint8_t* buffer = file->direct_buffer;
+    uint32_t padded = (used + SYS_DIRECT_ALIGN - 1) & ~(SYS_DIRECT_ALIGN - 1);
+    if (padded != used)
+    {
+        memset(buffer + used, 0, padded - used);
+
+        // last block is written whole, so keep data that is already in file after buffer
+        if (file->direct_offset + used < file->direct_end)
+        {
+            uint8_t* block = buffer + SYS_DIRECT_BUFFER_SIZE;
+            uint32_t got = sys_read_some(file, file->direct_offset + padded - SYS_DIRECT_ALIGN, block, SYS_DIRECT_ALIGN);
+            uint32_t from = used % SYS_DIRECT_ALIGN;
+            if (got > from)
+            {
+                memcpy(buffer + used, block + from, got - from);
+            }
+        }
+    }
+
+    sys_write_all(file, file->direct_offset, buffer, padded);
+    if (file->direct_offset + used > file->direct_end)
+    {
+        file->direct_end = file->direct_offset + used;
+    }
+    file->direct_size = 0;
+}
+
+static void sys_direct_done(sys_file file)
+{
+    if (file->direct_write)
+    {
+        // last block was padded, cut file to its real size
+        sys_direct_flush(file);
+        sys_truncate(file, file->direct_end);
+    }
+    sys_realloc(file->direct_memory, 0);
+}
+
+static void sys_read_direct(sys_file file, uint64_t offset, void* buffer, uint32_t size)
+{
+    uint8_t* data = buffer;
+    while (size != 0)
+    {
+        uint64_t end = file->direct_offset + file->direct_size;
+        if (offset >= file->direct_offset && offset < end)
+        {
+            uint32_t available = (uint32_t)min64(end - offset, size);
+            memcpy(data, file->direct_buffer + (offset - file->direct_offset), available);
+            data += available;
+            offset += available;
+            size -= available;
+            continue;
+        }
+
+        // unaligned edges of items are read as whole aligned blocks
+        file->direct_offset = offset & ~(uint64_t)(SYS_DIRECT_ALIGN - 1);
+        file->direct_size = sys_read_some(file, file->direct_offset, file->direct_buffer, SYS_DIRECT_BUFFER_SIZE);
+        if (file->direct_offset + file->direct_size <= offset)
+        {
+            sys_error("ERROR: failed to read %u bytes from file\n", size);
+        }
+    }
+}
+
+static void sys_write_direct(sys_file file, uint64_t offset, const void* buffer, uint32_t size)
+{
+    const uint8_t* data = buffer;
+    while (size != 0)
+    {
+        uint64_t start = file->direct_offset;
+        if (offset < start || offset > start + file->direct_size || offset - start >= SYS_DIRECT_BUFFER_SIZE)
+        {
+            // write does not continue data in buffer, start new one from block where it begins
+            sys_direct_flush(file);
+            file->direct_offset = offset & ~(uint64_t)(SYS_DIRECT_ALIGN - 1);
+
+            uint32_t head = (uint32_t)(offset - file->direct_offset);
+            if (head != 0)
+            {
+                uint32_t got = 0;
+                if (file->direct_offset < file->direct_end)
+                {
+                    got = sys_read_some(file, file->direct_offset, file->direct_buffer, SYS_DIRECT_ALIGN);
+                }
+                memset(file->direct_buffer + got, 0, SYS_DIRECT_ALIGN - got);
+            }
+            file->direct_size = head;
+            continue;
+        }
+
+        uint32_t pos = (uint32_t)(offset - start);
+        uint32_t count = min32(SYS_DIRECT_BUFFER_SIZE - pos, size);
+        memcpy(file->direct_buffer + pos, data, count);
+        if (pos + count > file->direct_size)
+        {
+            file->direct_size = pos + count;
+        }
+        data += count;
+        offset += count;
+        size -= count;
+
+        if (file->direct_size == SYS_DIRECT_BUFFER_SIZE)
+        {
+            sys_direct_flush(file);
+            file->direct_offset += SYS_DIRECT_BUFFER_SIZE;
+        }
+    }
+}
+
+// finds next run of aligned zero blocks after start, data starts at offset in file
+static int sys_next_zeros(const uint8_t* data, uint64_t offset, uint64_t end, uint64_t* start, uint64_t* stop)
+{
+    uint64_t block = (*start + SYS_SPARSE_BLOCK - 1) & ~(uint64_t)(SYS_SPARSE_BLOCK - 1);
+    for (; block + SYS_SPARSE_BLOCK <= end; block += SYS_SPARSE_BLOCK)
+    {
+        if (is_zero(data + (block - offset), SYS_SPARSE_BLOCK))
+        {
+            uint64_t zeros = block + SYS_SPARSE_BLOCK;
+            while (zeros + SYS_SPARSE_BLOCK <= end && is_zero(data + (zeros - offset), SYS_SPARSE_BLOCK))
+            {
+                zeros += SYS_SPARSE_BLOCK;
+            }
+            *start = block;
+            *stop = zeros;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void sys_punch_zeros(sys_file file, const uint8_t* data, uint64_t size)
+{
+    uint64_t start = 0;
+    uint64_t stop;
+    while (sys_next_zeros(data, 0, size, &start, &stop))
+    {
+        sys_punch(file, start, stop - start);
+        start = stop;
+    }
+}
+
+// zero blocks in part of file that was not written yet are skipped, so they stay as holes
+static void sys_write_sparse(sys_file file, uint64_t offset, const void* buffer, uint32_t size)
+{
+    const uint8_t* data = buffer;
+    uint64_t end = offset + size;
+    uint64_t written = offset;
+    uint64_t start = offset;
+    uint64_t stop;
+    while (sys_next_zeros(data, offset, end, &start, &stop))
+    {
+        if (start > written)
+        {
+            sys_write_all(file, written, data + (written - offset), (uint32_t)(start - written));
+        }
+        if (start < file->reserved)
+        {
+            sys_punch(file, start, min64(stop, file->reserved) - start);
+        }
+        written = start = stop;
+    }
+    if (written < end)
+    {
+        sys_write_all(file, written, data + (written - offset), (uint32_t)(end - written));
+    }
+}
+
+int sys_seekable(sys_file file)
+{
+    return !file->stream;
+}
+
+void sys_retain(sys_file file, int retain)
+{
+    if (retain && file->retained_size != file->offset)
+    {
+        sys_error("ERROR: internal error, stream data can be retained only from its beginning\n");
+    }
+    file->retain = retain;
+}
+
+void sys_follow(sys_file file)
+{
+    file->follow = 1;
+}
+
+static void sys_read_follow(sys_file file, uint64_t offset, void* buffer, uint32_t size)
+{
+    uint8_t* data = buffer;
+    time_t last = time(NULL);
+    while (size != 0)
+    {
+        uint32_t read = sys_read_some(file, offset, data, size);
+        if (read == 0)
+        {
+            // data is not written yet, wait until file grows
+            if (time(NULL) - last > SYS_FOLLOW_TIMEOUT)
+            {
+                sys_error("ERROR: file did not grow for %u seconds, giving up\n", SYS_FOLLOW_TIMEOUT);
+            }
+            sys_sleep(SYS_FOLLOW_POLL_MSEC);
+            continue;
+        }
+
+        data += read;
+        offset += read;
+        size -= read;
+        last = time(NULL);
+    }
+}
+
+static void sys_read_stream_next(sys_file file, void* buffer, uint32_t size)
+{
+    sys_read_next(file, buffer, size);
+    if (file->retain)
+    {
+        if (file->retained_size + size > file->retained_allocated)
+        {
+            file->retained_allocated = 2 * (file->retained_size + size);
+            file->retained = sys_realloc(file->retained, (size_t)file->retained_allocated);
+        }
+        memcpy(file->retained + file->retained_size, buffer, size);
+        file->retained_size += size;
+    }
+    file->offset += size;
+}
+
+static void sys_read_stream(sys_file file, uint64_t offset, void* buffer, uint32_t size)
+{
+    uint8_t* data = buffer;
+
+    // data before current position can come only from retained memory
+    if (offset < file->offset)
+    {
+        if (offset + size <= file->retained_size)
+        {
+            memcpy(data, file->retained + offset, size);
+            return;
+        }
+        if (offset >= file->retained_size || file->retained_size != file->offset)
+        {
+            sys_error("ERROR: cannot seek backwards in input stream, pkg data is in unsupported order\n");
+        }
+
+        uint32_t available = (uint32_t)(file->retained_size - offset);
+        memcpy(data, file->retained + offset, available);
+        data += available;
+        size -= available;
+    }
+
+    while (file->offset < offset)
+    {
+        uint8_t skip[SYS_STREAM_SKIP_SIZE];
+        sys_read_stream_next(file, skip, (uint32_t)min64(offset - file->offset, sizeof(skip)));
+    }
+
+    sys_read_stream_next(file, data, size);
+}
+
+// hash set of already created folders, slots store offset+1 into names
+static char* gFolderNames;
+static uint32_t gFolderNamesSize;
+static uint32_t gFolderNamesAllocated;
+static uint32_t* gFolderSlots;
+static uint32_t gFolderCount;
+static uint32_t gFolderCapacity;
+
+static uint32_t sys_folder_hash(const char* path, size_t length)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261U;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ (uint8_t)path[i]) * 16777619U;
+    }
+    return hash;
+}
+
+// returns slot where path is or where it should be inserted
+static uint32_t* sys_folder_find(const char* path, size_t length)
+{
+    uint32_t mask = gFolderCapacity - 1;
+    uint32_t i = sys_folder_hash(path, length) & mask;
+    for (;;)
+    {
+        uint32_t* slot = gFolderSlots + i;
+        if (*slot == 0)
+        {
+            return slot;
+        }
+        const char* name = gFolderNames + *slot - 1;
+        if (strncmp(name, path, length) == 0 && name[length] == 0)
+        {
+            return slot;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+static void sys_folder_add(const char* path, size_t length)
+{
+    if (2 * (gFolderCount + 1) > gFolderCapacity)
+    {
+        uint32_t* old_slots = gFolderSlots;
+        uint32_t old_capacity = gFolderCapacity;
+
+        gFolderCapacity = old_capacity ? 2 * old_capacity : 256;
+        gFolderSlots = sys_realloc(NULL, gFolderCapacity * sizeof(uint32_t));
+        memset(gFolderSlots, 0, gFolderCapacity * sizeof(uint32_t));
+        for (uint32_t i = 0; i < old_capacity; i++)
+        {
+            if (old_slots[i])
+            {
+                const char* name = gFolderNames + old_slots[i] - 1;
+                *sys_folder_find(name, strlen(name)) = old_slots[i];
+            }
+        }
+        if (old_slots)
+        {
+            sys_realloc(old_slots, 0);
+        }
+    }
+
+    if (gFolderNamesSize + length + 1 > gFolderNamesAllocated)
+    {
+        gFolderNamesAllocated = 2 * (gFolderNamesSize + (uint32_t)length + 1);
+        gFolderNames = sys_realloc(gFolderNames, gFolderNamesAllocated);
+    }
+    memcpy(gFolderNames + gFolderNamesSize, path, length);
+    gFolderNames[gFolderNamesSize + length] = 0;
+
+    *sys_folder_find(path, length) = gFolderNamesSize + 1;
+    gFolderNamesSize += (uint32_t)length + 1;
+    gFolderCount++;
+}
+
+void sys_mkdir(const char* path)
+{
+    size_t length = strlen(path);
+    // root of absolute path
+    if (length == 0)
+    {
+        return;
+    }
+    if (gFolderCount != 0 && *sys_folder_find(path, length) != 0)
+    {
+        return;
+    }
+
+    const char* last = strrchr(path, '/');
+    if (last)
+    {
+        char parent[1024];
+        if ((size_t)(last - path) >= sizeof(parent))
+        {
+            sys_error("ERROR: folder name too long\n");
+        }
+        memcpy(parent, path, last - path);
+        parent[last - path] = 0;
+        sys_mkdir(parent);
+        if (last[1] == 0)
+        {
+            return;
+        }
     }
     sys_mkdir_real(path);
+    sys_folder_add(path, length);
 }
 
 void* sys_realloc(void* ptr, size_t size)
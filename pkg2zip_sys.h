@@ -5,21 +5,68 @@
 // correctly outputs utf8 string
 void sys_output_init(void);
 void sys_output_done(void);
+// used when stdout is used for output data
+void sys_output_stderr(void);
 void sys_output(const char* msg, ...);
 void NORETURN sys_error(const char* msg, ...);
 
 void sys_output_progress_init(uint64_t size);
 void sys_output_progress(uint64_t progress);
 
-typedef void* sys_file;
+typedef struct sys_file_data* sys_file;
 
 void sys_mkdir(const char* path);
 
+// files opened or created after this call bypass OS cache
+void sys_direct_io(void);
+// files are read ahead and dropped from OS cache behind current position in windows of this size
+void sys_cache_window(uint32_t size);
+// prints amount of i/o done
+void sys_output_stats(void);
+
+// "-" opens stream from stdin, its size is unknown and returned as 0
+// "http://" url reads file from http server with range requests
 sys_file sys_open(const char* fname, uint64_t* size);
+// "-" creates stream to stdout
 sys_file sys_create(const char* fname);
 void sys_close(sys_file file);
+// replaces existing file
+void sys_rename(const char* from, const char* to);
+// streams can be read or written only sequentially
+int sys_seekable(sys_file file);
+// while enabled, stream keeps all data that is read, so it can be read again later
+void sys_retain(sys_file file, int retain);
+// file is still being written by other process, reads wait until requested data is available
+void sys_follow(sys_file file);
 void sys_read(sys_file file, uint64_t offset, void* buffer, uint32_t size);
 void sys_write(sys_file file, uint64_t offset, const void* buffer, uint32_t size);
+// preallocates space for file of expected size, unused space is released when file is closed
+// returns 0 if space could not be reserved
+int sys_reserve(sys_file file, uint64_t size);
+// zero blocks written to new part of file become holes
+void sys_sparse(sys_file file);
+// sets file size and maps whole file in memory for writing until file is closed
+// returns NULL if file cannot be mapped or space for it cannot be reserved
+void* sys_map(sys_file file, uint64_t size);
+
+typedef struct sys_socket_data* sys_socket;
+
+// returns NULL if host cannot be resolved or connection cannot be established
+sys_socket sys_connect(const char* host, const char* port);
+void sys_disconnect(sys_socket sock);
+// returns 0 if connection is broken
+int sys_send(sys_socket sock, const void* buffer, uint32_t size);
+// returns 0 if connection is closed, -1 on error
+int sys_recv(sys_socket sock, void* buffer, uint32_t size);
+
+typedef struct sys_thread_data* sys_thread;
+typedef void sys_thread_func(void* arg);
+
+// number of logical cpus
+uint32_t sys_cpu_count(void);
+sys_thread sys_thread_start(sys_thread_func* func, void* arg);
+// waits until thread finishes and frees it
+void sys_thread_join(sys_thread thread);
 
 // if !ptr && size => malloc
 // if ptr && !size => free
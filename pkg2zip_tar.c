@@ -0,0 +1,364 @@
+#include "pkg2zip_tar.h"
+#include "pkg2zip_utils.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// https://pubs.opengroup.org/onlinepubs/9699919799/utilities/pax.html
+
+#define TAR_BLOCK_SIZE 512
+// archive is padded to multiple of default blocking factor, same as tar tools do
+#define TAR_RECORD_SIZE (20 * TAR_BLOCK_SIZE)
+
+#define TAR_NAME_SIZE 100
+#define TAR_MAX_OCTAL_SIZE 077777777777ULL
+
+#define TAR_TYPE_FILE '0'
+#define TAR_TYPE_DIRECTORY '5'
+#define TAR_TYPE_PAX 'x'
+
+#define TAR_FILE_MODE 0644
+#define TAR_DIRECTORY_MODE 0755
+
+static const uint8_t tar_zero[TAR_BLOCK_SIZE];
+
+#if defined(PKG2ZIP_ZSTD)
+static void tar_zstd_init(tar* t, int level)
+{
+    t->zstd = ZSTD_createCCtx();
+    if (t->zstd == NULL)
+    {
+        sys_error("ERROR: failed to create zstd context\n");
+    }
+    t->zstd_buffer_size = ZSTD_CStreamOutSize();
+    t->zstd_buffer = sys_realloc(NULL, t->zstd_buffer_size);
+
+    ZSTD_CCtx_setParameter(t->zstd, ZSTD_c_compressionLevel, level);
+    // fails if zstd library is built without multi-threading, then compression runs on calling thread
+    uint32_t cpus = sys_cpu_count();
+    if (cpus > 1)
+    {
+        ZSTD_CCtx_setParameter(t->zstd, ZSTD_c_nbWorkers, (int)cpus);
+    }
+}
+
+static void tar_zstd_compress(tar* t, const void* data, size_t size, ZSTD_EndDirective mode)
+{
+    ZSTD_inBuffer input = { data, size, 0 };
+    for (;;)
+    {
+        ZSTD_outBuffer output = { t->zstd_buffer, t->zstd_buffer_size, 0 };
+        size_t remaining = ZSTD_compressStream2(t->zstd, &output, &input, mode);
+        if (ZSTD_isError(remaining))
+        {
+            sys_error("ERROR: zstd compression failed: %s\n", ZSTD_getErrorName(remaining));
+        }
+
+        if (output.pos != 0)
+        {
+            sink_write(t->sink, t->zstd_buffer, (uint32_t)output.pos);
+        }
+
+        if (mode == ZSTD_e_end ? remaining == 0 : input.pos == input.size)
+        {
+            break;
+        }
+    }
+}
+#endif
+
+static void tar_output(tar* t, const void* data, uint32_t size)
+{
+#if defined(PKG2ZIP_ZSTD)
+    if (t->zstd)
+    {
+        tar_zstd_compress(t, data, size, ZSTD_e_continue);
+    }
+    else
+#endif
+    {
+        sink_write(t->sink, data, size);
+    }
+    t->total += size;
+}
+
+static void tar_pad(tar* t, uint32_t alignment)
+{
+    uint32_t padding = (uint32_t)((alignment - t->total % alignment) % alignment);
+    while (padding != 0)
+    {
+        uint32_t size = min32(padding, sizeof(tar_zero));
+        tar_output(t, tar_zero, size);
+        padding -= size;
+    }
+}
+
+// writes value as zero padded octal number with terminating NUL character
+static void tar_octal(uint8_t* field, size_t size, uint64_t value)
+{
+    field[size - 1] = 0;
+    for (size_t i = size - 1; i-- != 0; )
+    {
+        field[i] = (uint8_t)('0' + (value & 7));
+        value >>= 3;
+    }
+}
+
+static void tar_header(tar* t, const char* name, size_t name_length, char type, uint32_t mode, uint64_t size)
+{
+    uint8_t header[TAR_BLOCK_SIZE] = { 0 };
+    // name
+    memcpy(header, name, min32((uint32_t)name_length, TAR_NAME_SIZE));
+    // mode
+    tar_octal(header + 100, 8, mode);
+    // uid
+    tar_octal(header + 108, 8, 0);
+    // gid
+    tar_octal(header + 116, 8, 0);
+    // size, larger values are also in pax header
+    if (size > TAR_MAX_OCTAL_SIZE)
+    {
+        // base-256 encoding understood by gnu tar and libarchive
+        header[124] = 0x80;
+        set64be(header + 128, size);
+    }
+    else
+    {
+        tar_octal(header + 124, 12, size);
+    }
+    // mtime
+    tar_octal(header + 136, 12, t->time);
+    // chksum is calculated with its own field filled with spaces
+    memset(header + 148, ' ', 8);
+    // typeflag
+    header[156] = (uint8_t)type;
+    // magic and version
+    memcpy(header + 257, "ustar\0" "00", 8);
+
+    uint32_t checksum = 0;
+    for (size_t i = 0; i < sizeof(header); i++)
+    {
+        checksum += header[i];
+    }
+    tar_octal(header + 148, 7, checksum);
+
+    tar_output(t, header, sizeof(header));
+}
+
+// appends "length key=value\n" record, where length includes itself
+static size_t tar_pax_record(char* record, const char* key, const char* value, size_t value_length)
+{
+    size_t size = strlen(key) + value_length + 3;
+    size_t digits = 1;
+    for (size_t n = 10; size + digits >= n; n *= 10)
+    {
+        digits++;
+    }
+
+    int prefix = sprintf(record, "%u %s=", (uint32_t)(size + digits), key);
+    memcpy(record + prefix, value, value_length);
+    record[prefix + value_length] = '\n';
+    return size + digits;
+}
+
+static void tar_entry(tar* t, const char* name, char type, uint32_t mode, uint64_t size)
+{
+    size_t name_length = strlen(name);
+
+    // pax extended header for names and sizes that do not fit in ustar header
+    char pax[TAR_MAX_FILENAME + 64];
+    size_t pax_size = 0;
+    if (name_length > TAR_NAME_SIZE)
+    {
+        pax_size += tar_pax_record(pax + pax_size, "path", name, name_length);
+    }
+    if (size > TAR_MAX_OCTAL_SIZE)
+    {
+        char value[32];
+        int value_length = sprintf(value, "%llu", (unsigned long long)size);
+        pax_size += tar_pax_record(pax + pax_size, "size", value, value_length);
+    }
+
+    if (pax_size != 0)
+    {
+        static const char pax_name[] = "././@PaxHeader";
+        tar_header(t, pax_name, sizeof(pax_name) - 1, TAR_TYPE_PAX, TAR_FILE_MODE, pax_size);
+        tar_output(t, pax, (uint32_t)pax_size);
+        tar_pad(t, TAR_BLOCK_SIZE);
+    }
+
+    tar_header(t, name, name_length, type, mode, size);
+}
+
+void tar_create(tar* t, const char* name, int zstd_level)
+{
+    t->sink = sink_begin(name);
+    t->total = 0;
+    t->time = (uint64_t)time(NULL);
+    t->pending = 0;
+    t->size = 0;
+    t->written = 0;
+    t->buffer = NULL;
+    t->buffer_offset = 0;
+    t->buffer_size = 0;
+    t->buffer_allocated = 0;
+
+#if defined(PKG2ZIP_ZSTD)
+    t->zstd = NULL;
+    t->zstd_buffer = NULL;
+    if (zstd_level != 0)
+    {
+        tar_zstd_init(t, zstd_level);
+    }
+#else
+    if (zstd_level != 0)
+    {
+        sys_error("ERROR: pkg2zip is built without zstd support\n");
+    }
+#endif
+}
+
+void tar_add_folder(tar* t, const char* name)
+{
+    char path[TAR_MAX_FILENAME + 1];
+    if (snprintf(path, sizeof(path), "%s/", name) >= (int)sizeof(path))
+    {
+        sys_error("ERROR: dirname too long\n");
+    }
+    tar_entry(t, path, TAR_TYPE_DIRECTORY, TAR_DIRECTORY_MODE, 0);
+}
+
+void tar_begin_file(tar* t, const char* name)
+{
+    if (strlen(name) > TAR_MAX_FILENAME)
+    {
+        sys_error("ERROR: filename too long\n");
+    }
+    strcpy(t->name, name);
+
+    t->pending = 1;
+    t->size = 0;
+    t->written = 0;
+    t->buffer_offset = 0;
+    t->buffer_size = 0;
+}
+
+void tar_reserve(tar* t, uint64_t size)
+{
+    // ignored when there is no current file or its data is already being collected in memory
+    if (!t->pending || t->buffer_size != 0 || t->buffer_offset != 0)
+    {
+        return;
+    }
+
+    tar_entry(t, t->name, TAR_TYPE_FILE, TAR_FILE_MODE, size);
+    t->pending = 0;
+    t->size = size;
+}
+
+// copies data into memory buffer of current file, gap after previous data is zero filled
+static void tar_buffer(tar* t, uint64_t offset, const void* data, uint32_t size)
+{
+    uint64_t end = offset + size;
+    if (end > t->buffer_allocated)
+    {
+        uint64_t allocated = t->buffer_allocated ? t->buffer_allocated : 1 << 20;
+        while (allocated < end)
+        {
+            allocated *= 2;
+        }
+        t->buffer = sys_realloc(t->buffer, (size_t)allocated);
+        t->buffer_allocated = allocated;
+    }
+
+    if (offset > t->buffer_size)
+    {
+        memset(t->buffer + t->buffer_size, 0, (size_t)(offset - t->buffer_size));
+    }
+    memcpy(t->buffer + offset, data, size);
+    t->buffer_size = end > t->buffer_size ? end : t->buffer_size;
+}
+
+void tar_write_file(tar* t, const void* data, uint32_t size)
+{
+    if (t->pending)
+    {
+        tar_buffer(t, t->buffer_offset, data, size);
+        t->buffer_offset += size;
+        return;
+    }
+
+    t->written += size;
+    if (t->written > t->size)
+    {
+        sys_error("ERROR: more data written to tar file than its declared size\n");
+    }
+    tar_output(t, data, size);
+}
+
+void tar_end_file(tar* t)
+{
+    if (t->pending)
+    {
+        tar_entry(t, t->name, TAR_TYPE_FILE, TAR_FILE_MODE, t->buffer_size);
+        t->pending = 0;
+
+        const uint8_t* data = t->buffer;
+        uint64_t size = t->buffer_size;
+        while (size != 0)
+        {
+            uint32_t chunk = (uint32_t)min64(size, 1 << 30);
+            tar_output(t, data, chunk);
+            data += chunk;
+            size -= chunk;
+        }
+    }
+    else if (t->written != t->size)
+    {
+        sys_error("ERROR: less data written to tar file than its declared size\n");
+    }
+
+    tar_pad(t, TAR_BLOCK_SIZE);
+}
+
+void tar_close(tar* t)
+{
+    // end of archive is marked with two zero blocks
+    tar_output(t, tar_zero, sizeof(tar_zero));
+    tar_output(t, tar_zero, sizeof(tar_zero));
+    tar_pad(t, TAR_RECORD_SIZE);
+
+#if defined(PKG2ZIP_ZSTD)
+    if (t->zstd)
+    {
+        tar_zstd_compress(t, NULL, 0, ZSTD_e_end);
+        ZSTD_freeCCtx(t->zstd);
+        sys_realloc(t->zstd_buffer, 0);
+    }
+#endif
+
+    sink_end(t->sink);
+    if (t->buffer != NULL)
+    {
+        sys_realloc(t->buffer, 0);
+    }
+}
+
+void tar_write_file_at(tar* t, uint64_t offset, const void* data, uint32_t size)
+{
+    if (!t->pending)
+    {
+        sys_error("ERROR: cannot write at specific offset in tar file with declared size\n");
+    }
+    tar_buffer(t, offset, data, size);
+}
+
+void tar_set_offset(tar* t, uint64_t offset)
+{
+    if (!t->pending)
+    {
+        sys_error("ERROR: cannot change offset in tar file with declared size\n");
+    }
+    t->buffer_offset = offset;
+}
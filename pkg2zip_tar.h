@@ -0,0 +1,48 @@
+#pragma once
+
+#include "pkg2zip_sys.h"
+#include "pkg2zip_sink.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(PKG2ZIP_ZSTD)
+#include <zstd.h>
+#endif
+
+#define TAR_MAX_FILENAME 1024
+
+// tar is written strictly sequentially, so file size must be known before file data
+// it is declared with tar_reserve, otherwise file is collected in memory until tar_end_file
+typedef struct {
+    sink* sink;
+    uint64_t total;
+    uint64_t time;
+#if defined(PKG2ZIP_ZSTD)
+    ZSTD_CCtx* zstd;
+    uint8_t* zstd_buffer;
+    size_t zstd_buffer_size;
+#endif
+    int pending; // current file header is not yet written
+    char name[TAR_MAX_FILENAME + 1];
+    uint64_t size;
+    uint64_t written;
+    uint8_t* buffer;
+    uint64_t buffer_offset;
+    uint64_t buffer_size;
+    uint64_t buffer_allocated;
+} tar;
+
+// zstd level 0 writes uncompressed tar, otherwise whole tar is compressed with zstd
+void tar_create(tar* t, const char* name, int zstd_level);
+void tar_add_folder(tar* t, const char* name);
+void tar_begin_file(tar* t, const char* name);
+void tar_write_file(tar* t, const void* data, uint32_t size);
+void tar_end_file(tar* t);
+void tar_close(tar* t);
+// declares exact size of current file, must be called before any data is written to it
+void tar_reserve(tar* t, uint64_t size);
+
+// only for files that are collected in memory
+void tar_write_file_at(tar* t, uint64_t offset, const void* data, uint32_t size);
+void tar_set_offset(tar* t, uint64_t offset);
@@ -2,6 +2,12 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define PKG_SSE2 1
+#  include <emmintrin.h>
+#endif
 
 #if defined(_MSC_VER)
 #  define NORETURN __declspec(noreturn)
@@ -116,3 +122,34 @@ static inline void set64be(uint8_t* bytes, uint64_t x)
     bytes[6] = (uint8_t)(x >> 8);
     bytes[7] = (uint8_t)x;
 }
+
+// size must be multiple of 64
+static inline int is_zero(const uint8_t* data, size_t size)
+{
+#if defined(PKG_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (size_t i = 0; i < size; i += 64)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(data + i + 0));
+        __m128i b = _mm_loadu_si128((const __m128i*)(data + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(data + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*)(data + i + 48));
+        __m128i x = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) != 0xffff)
+        {
+            return 0;
+        }
+    }
+#else
+    for (size_t i = 0; i < size; i += 64)
+    {
+        uint64_t x[8];
+        memcpy(x, data + i, sizeof(x));
+        if ((x[0] | x[1] | x[2] | x[3] | x[4] | x[5] | x[6] | x[7]) != 0)
+        {
+            return 0;
+        }
+    }
+#endif
+    return 1;
+}
@@ -8,16 +8,23 @@
 #include "pkg2zip_crc32.h"
 #include "pkg2zip_utils.h"
 
+#include <stdio.h>
 #include <string.h>
 #include <time.h>
 
 #define ZIP_MEMORY_BLOCK (1024 * 1024)
 
+// how much data is trial compressed to check if file is worth compressing
+#define ZIP_SAMPLE_SIZE (64 * 1024)
+
 // https://pkware.cachefly.net/webdocs/casestudies/APPNOTE.TXT
 
 #define ZIP_VERSION 45
+#define ZIP_VERSION_ZSTD 63
 #define ZIP_METHOD_STORE 0
 #define ZIP_METHOD_DEFLATE 8
+#define ZIP_METHOD_ZSTD 93
+#define ZIP_DATA_DESCRIPTOR_FLAG (1 << 3)
 #define ZIP_UTF8_FLAG (1 << 11)
 
 #define ZIP_DOS_ATTRIBUTE_DIRECTORY 0x10
@@ -29,8 +36,19 @@
 #define ZIP64_EOC_DIR_LOCATOR_SIZE 20
 #define ZIP_EOC_DIR_SIZE 22
 
+#define ZIP64_EXTRA_MAX_SIZE 32
+#define ZIP64_LOCAL_EXTRA_SIZE 20
+#define ZIP64_DATA_DESCRIPTOR_SIZE 24
+
 #define ZIP_LOCAL_HEADER_CRC32_OFFSET 14
-#define ZIP_LOCAL_HEADER_FILENAME_LENGTH_OFFSET 26
+
+#define ZIP_SPLIT_SIGNATURE_SIZE 4
+
+// same extra field as zipalign from Android SDK uses, alignment followed by zero padding
+#define ZIP_ALIGN_EXTRA_ID 0xd935
+#define ZIP_ALIGN_EXTRA_SIZE 6
+
+static const uint8_t zip_zero[ZIP_MAX_ALIGN];
 
 struct zip_file
 {
@@ -38,9 +56,141 @@ struct zip_file
     uint64_t size;
     uint64_t compressed;
     uint32_t crc32;
-    int compress;
+    uint32_t name; // offset in zip names
+    uint16_t name_length;
+    uint16_t flags;
+    uint16_t method;
+    uint16_t align;
+    int folder;
 };
 
+static uint16_t zip_version(const zip_file* f)
+{
+    return f->method == ZIP_METHOD_ZSTD ? ZIP_VERSION_ZSTD : ZIP_VERSION;
+}
+
+// name of volume with this index, when zip is finished last volume is renamed to name of zip
+static void zip_volume_name(const zip* z, uint32_t index, char* name)
+{
+    size_t length = strlen(z->name);
+    if (length >= 4 && strcmp(z->name + length - 4, ".zip") == 0)
+    {
+        length -= 4;
+    }
+    sprintf(name, "%.*s.z%02u", (int)length, z->name, index + 1);
+}
+
+static void zip_volume_add(zip* z, uint64_t start)
+{
+    char name[sizeof(z->name) + 16];
+    zip_volume_name(z, z->volume_count, name);
+
+    z->volume_start = sys_realloc(z->volume_start, (z->volume_count + 1) * sizeof(*z->volume_start));
+    z->volumes = sys_realloc(z->volumes, (z->volume_count + 1) * sizeof(*z->volumes));
+    z->volume_start[z->volume_count] = start;
+    z->volumes[z->volume_count] = sink_begin(name);
+    z->volume_count++;
+}
+
+// returns volume that contains this offset, new volumes are started when offset is past last one
+static uint32_t zip_volume_at(zip* z, uint64_t offset)
+{
+    while (offset >= z->volume_start[z->volume_count - 1] + z->split)
+    {
+        zip_volume_add(z, z->volume_start[z->volume_count - 1] + z->split);
+    }
+
+    uint32_t index = z->volume_count - 1;
+    while (offset < z->volume_start[index])
+    {
+        index--;
+    }
+    return index;
+}
+
+// headers must not be split between volumes, if record does not fit then new volume is started for it
+static void zip_volume_keep(zip* z, uint64_t offset, uint32_t size)
+{
+    if (z->split == 0)
+    {
+        return;
+    }
+
+    uint32_t index = zip_volume_at(z, offset);
+    if (offset != z->volume_start[index] && offset + size > z->volume_start[index] + z->split)
+    {
+        zip_volume_add(z, offset);
+    }
+}
+
+// closes volumes before this offset, nothing is written to them anymore
+static void zip_volume_release(zip* z, uint64_t offset)
+{
+    if (z->split == 0)
+    {
+        return;
+    }
+
+    uint32_t index = zip_volume_at(z, offset);
+    while (z->volume_open < index)
+    {
+        sink_end(z->volumes[z->volume_open++]);
+    }
+}
+
+// disk number of offset in whole zip, and offset relative to beginning of that disk
+static uint32_t zip_disk(zip* z, uint64_t offset)
+{
+    return z->split ? zip_volume_at(z, offset) : 0;
+}
+
+static uint64_t zip_disk_offset(zip* z, uint64_t offset)
+{
+    return z->split ? offset - z->volume_start[zip_volume_at(z, offset)] : offset;
+}
+
+// writes data at offset in whole zip, for split zip it can go to several volumes
+static void zip_write_at(zip* z, uint64_t offset, const void* data, uint32_t size)
+{
+    if (z->split == 0)
+    {
+        sink_write_at(z->sink, offset, data, size);
+        return;
+    }
+
+    const uint8_t* data8 = data;
+    while (size != 0)
+    {
+        uint32_t index = zip_volume_at(z, offset);
+        if (index < z->volume_open)
+        {
+            sys_error("ERROR: internal error - writing to finished zip volume\n");
+        }
+
+        uint64_t end = index + 1 < z->volume_count ? z->volume_start[index + 1] : z->volume_start[index] + z->split;
+        uint32_t chunk = (uint32_t)min64(size, end - offset);
+        sink_write_at(z->volumes[index], offset - z->volume_start[index], data8, chunk);
+
+        data8 += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+}
+
+// writes data at current end of zip file
+static void zip_output(zip* z, const void* data, uint32_t size)
+{
+    if (z->stream)
+    {
+        sink_write(z->sink, data, size);
+    }
+    else
+    {
+        zip_write_at(z, z->total, data, size);
+    }
+    z->total += size;
+}
+
 static zip_file* zip_new_file(zip* z)
 {
     if (z->count == z->max)
@@ -53,20 +203,75 @@ static zip_file* zip_new_file(zip* z)
     return z->files + z->count++;
 }
 
-void zip_create(zip* z, const char* name)
+static uint32_t zip_add_name(zip* z, const char* name, size_t name_length)
 {
-    z->file = sys_create(name);
+    while (z->names_size + name_length > z->names_allocated)
+    {
+        z->names_allocated += ZIP_MEMORY_BLOCK;
+        z->names = sys_realloc(z->names, z->names_allocated);
+    }
+
+    uint32_t offset = z->names_size;
+    memcpy(z->names + offset, name, name_length);
+    z->names_size += (uint32_t)name_length;
+    return offset;
+}
+
+void zip_create(zip* z, const char* name, uint64_t split_size, uint32_t align)
+{
+    z->align = align;
+    z->split = split_size;
+    z->volume_count = 0;
+    z->volume_open = 0;
+    z->volume_start = NULL;
+    z->volumes = NULL;
+    if (split_size != 0)
+    {
+        if (strlen(name) >= sizeof(z->name))
+        {
+            sys_error("ERROR: zip file name too long\n");
+        }
+        strcpy(z->name, name);
+
+        z->sink = NULL;
+        zip_volume_add(z, 0);
+        if (!sink_seekable(z->volumes[0]))
+        {
+            sys_error("ERROR: split zip can be written only to local files\n");
+        }
+        z->stream = 0;
+    }
+    else
+    {
+        z->sink = sink_begin(name);
+        z->stream = !sink_seekable(z->sink);
+    }
     z->total = 0;
     z->count = 0;
     z->max = 0;
     z->allocated = 0;
     z->files = NULL;
     z->current = NULL;
+    z->names_size = 0;
+    z->names_allocated = 0;
+    z->names = NULL;
+#if defined(PKG2ZIP_ZSTD)
+    z->zstd = NULL;
+    z->zstd_buffer = NULL;
+    z->zstd_buffer_size = 0;
+#endif
 
     time_t t = time(NULL);
     struct tm* tm = localtime(&t);
     z->date = (uint16_t)(((tm->tm_year + 1900 - 1980) << 9) + ((tm->tm_mon + 1) << 5) + tm->tm_mday);
     z->time = (uint16_t)((tm->tm_hour << 11) + (tm->tm_min << 5) + (tm->tm_sec / 2));
+
+    if (split_size != 0)
+    {
+        // first volume of split zip starts with spanning signature
+        static const uint8_t signature[ZIP_SPLIT_SIGNATURE_SIZE] = { 0x50, 0x4b, 0x07, 0x08 };
+        zip_output(z, signature, sizeof(signature));
+    }
 }
 
 void zip_add_folder(zip* z, const char* name)
@@ -77,18 +282,27 @@ void zip_add_folder(zip* z, const char* name)
         sys_error("ERROR: dirname too long\n");
     }
 
+    zip_volume_keep(z, z->total, ZIP_LOCAL_HEADER_SIZE + (uint32_t)name_length);
+    zip_volume_release(z, z->total);
+
     zip_file* f = zip_new_file(z);
     f->offset = z->total;
     f->size = 0;
     f->compressed = 0;
     f->crc32 = 0;
-    f->compress = 0;
+    f->name = zip_add_name(z, name, name_length - 1);
+    f->name_length = (uint16_t)name_length;
+    f->flags = ZIP_UTF8_FLAG;
+    f->method = ZIP_METHOD_STORE;
+    f->align = 0;
+    f->folder = 1;
+    zip_add_name(z, "/", 1);
 
     uint8_t header[ZIP_LOCAL_HEADER_SIZE] = { 0x50, 0x4b, 0x03, 0x04 };
     // version needed to extract
     set16le(header + 4, ZIP_VERSION);
     // general purpose bit flag
-    set16le(header + 6, ZIP_UTF8_FLAG);
+    set16le(header + 6, f->flags);
     // compression method
     set16le(header + 8, ZIP_METHOD_STORE);
     // last mod file time
@@ -98,18 +312,71 @@ void zip_add_folder(zip* z, const char* name)
     // file name length
     set16le(header + 26, (uint16_t)name_length);
 
-    sys_write(z->file, z->total, header, sizeof(header));
-    z->total += sizeof(header);
+    zip_output(z, header, sizeof(header));
+
+    zip_output(z, z->names + f->name, f->name_length);
+}
+
+#if defined(PKG2ZIP_ZSTD)
+static void zip_zstd_init(zip* z, int level)
+{
+    if (z->zstd == NULL)
+    {
+        z->zstd = ZSTD_createCCtx();
+        if (z->zstd == NULL)
+        {
+            sys_error("ERROR: failed to create zstd context\n");
+        }
+        z->zstd_buffer_size = ZSTD_CStreamOutSize();
+        z->zstd_buffer = sys_realloc(NULL, z->zstd_buffer_size);
+
+        // fails if zstd library is built without multi-threading, then compression runs on calling thread
+        uint32_t cpus = sys_cpu_count();
+        if (cpus > 1)
+        {
+            ZSTD_CCtx_setParameter(z->zstd, ZSTD_c_nbWorkers, (int)cpus);
+        }
+    }
+
+    ZSTD_CCtx_reset(z->zstd, ZSTD_reset_session_only);
+    ZSTD_CCtx_setParameter(z->zstd, ZSTD_c_compressionLevel, level);
+}
 
-    sys_write(z->file, z->total, name, (uint16_t)name_length);
-    z->total += name_length - 1;
+static void zip_zstd_compress(zip* z, const void* data, size_t size, ZSTD_EndDirective mode)
+{
+    ZSTD_inBuffer input = { data, size, 0 };
+    for (;;)
+    {
+        ZSTD_outBuffer output = { z->zstd_buffer, z->zstd_buffer_size, 0 };
+        size_t remaining = ZSTD_compressStream2(z->zstd, &output, &input, mode);
+        if (ZSTD_isError(remaining))
+        {
+            sys_error("ERROR: zstd compression failed: %s\n", ZSTD_getErrorName(remaining));
+        }
+
+        if (output.pos != 0)
+        {
+            zip_output(z, z->zstd_buffer, (uint32_t)output.pos);
+            z->current->compressed += output.pos;
+        }
 
-    char slash = '/';
-    sys_write(z->file, z->total, &slash, 1);
-    z->total += 1;
+        // continue until all input is consumed, and for end until frame is fully flushed
+        if (mode == ZSTD_e_end ? remaining == 0 : input.pos == input.size)
+        {
+            break;
+        }
+    }
 }
+#else
+static void zip_zstd_init(zip* z, int level)
+{
+    (void)z;
+    (void)level;
+    sys_error("ERROR: pkg2zip is built without zstd support\n");
+}
+#endif
 
-uint64_t zip_begin_file(zip* z, const char* name, int compress)
+uint64_t zip_begin_file(zip* z, const char* name, int level)
 {
     size_t name_length = strlen(name);
     if (name_length > ZIP_MAX_FILENAME)
@@ -117,23 +384,32 @@ uint64_t zip_begin_file(zip* z, const char* name, int compress)
         sys_error("ERROR: filename too long\n");
     }
 
+    uint32_t max_extra_size = (z->stream ? ZIP64_LOCAL_EXTRA_SIZE : 0) + (z->align ? ZIP_ALIGN_EXTRA_SIZE + z->align : 0);
+    zip_volume_keep(z, z->total, ZIP_LOCAL_HEADER_SIZE + (uint32_t)name_length + max_extra_size);
+    zip_volume_release(z, z->total);
+
     zip_file* f = zip_new_file(z);
     f->offset = z->total;
     f->size = 0;
     f->compressed = 0;
-    f->compress = compress;
+    f->name = zip_add_name(z, name, name_length);
+    f->name_length = (uint16_t)name_length;
+    f->flags = ZIP_UTF8_FLAG | (z->stream ? ZIP_DATA_DESCRIPTOR_FLAG : 0);
+    f->method = level == 0 ? ZIP_METHOD_STORE : (level & ZIP_LEVEL_ZSTD) ? ZIP_METHOD_ZSTD : ZIP_METHOD_DEFLATE;
+    f->align = f->method == ZIP_METHOD_STORE ? (uint16_t)z->align : 0;
+    f->folder = 0;
     z->current = f;
 
     crc32_init(&z->crc32);
     z->crc32_set = 0;
 
-    uint8_t header[ZIP_LOCAL_HEADER_SIZE] = { 0x50, 0x4b, 0x03, 0x04 };
+    uint8_t header[ZIP_LOCAL_HEADER_SIZE + ZIP64_LOCAL_EXTRA_SIZE] = { 0x50, 0x4b, 0x03, 0x04 };
     // version needed to extract
-    set16le(header + 4, ZIP_VERSION);
+    set16le(header + 4, zip_version(f));
     // general purpose bit flag
-    set16le(header + 6, ZIP_UTF8_FLAG);
+    set16le(header + 6, f->flags);
     // compression method
-    set16le(header + 8, compress ? ZIP_METHOD_DEFLATE : ZIP_METHOD_STORE);
+    set16le(header + 8, f->method);
     // last mod file time
     set16le(header + 10, z->time);
     // last mod file date
@@ -141,27 +417,92 @@ uint64_t zip_begin_file(zip* z, const char* name, int compress)
     // file name length
     set16le(header + 26, (uint16_t)name_length);
 
-    sys_write(z->file, z->total, header, sizeof(header));
-    z->total += sizeof(header);
+    uint16_t extra_size = 0;
+    if (z->stream)
+    {
+        // sizes are not known in advance, they are written as 64-bit values in data descriptor
+        uint8_t* extra = header + ZIP_LOCAL_HEADER_SIZE;
+        extra_size = ZIP64_LOCAL_EXTRA_SIZE;
 
-    sys_write(z->file, z->total, name, (uint16_t)name_length);
-    z->total += name_length;
+        // compressed size
+        set32le(header + 18, 0xffffffff);
+        // uncompressed size
+        set32le(header + 22, 0xffffffff);
 
-    if (compress)
+        // zip64 Extended Information Extra Field
+        set16le(extra + 0, 1);
+        // size of this "extra" block, original and compressed sizes are left zero
+        set16le(extra + 2, extra_size - 2 * sizeof(uint16_t));
+    }
+
+    // stored data is padded to start at aligned offset in its volume, so it can be mapped directly
+    uint8_t align[ZIP_ALIGN_EXTRA_SIZE];
+    uint16_t align_size = 0;
+    if (f->align)
+    {
+        uint64_t data_offset = zip_disk_offset(z, f->offset) + ZIP_LOCAL_HEADER_SIZE + name_length + extra_size + ZIP_ALIGN_EXTRA_SIZE;
+        uint16_t padding = (uint16_t)((f->align - data_offset % f->align) % f->align);
+        align_size = ZIP_ALIGN_EXTRA_SIZE + padding;
+
+        // zipalign extra field
+        set16le(align + 0, ZIP_ALIGN_EXTRA_ID);
+        // size of this "extra" block
+        set16le(align + 2, align_size - 2 * sizeof(uint16_t));
+        // alignment
+        set16le(align + 4, f->align);
+    }
+
+    // extra field length
+    set16le(header + 28, extra_size + align_size);
+
+    zip_output(z, header, ZIP_LOCAL_HEADER_SIZE);
+
+    zip_output(z, name, (uint16_t)name_length);
+
+    if (extra_size)
+    {
+        zip_output(z, header + ZIP_LOCAL_HEADER_SIZE, extra_size);
+    }
+    if (align_size)
     {
-        int flags = tdefl_create_comp_flags_from_zip_params(MZ_BEST_SPEED, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
+        zip_output(z, align, sizeof(align));
+        if (align_size > sizeof(align))
+        {
+            zip_output(z, zip_zero, align_size - sizeof(align));
+        }
+    }
+
+    if (f->method == ZIP_METHOD_DEFLATE)
+    {
+        int flags = tdefl_create_comp_flags_from_zip_params(level, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
         tdefl_init(&z->tdefl, flags);
     }
+    else if (f->method == ZIP_METHOD_ZSTD)
+    {
+        zip_zstd_init(z, level & ~ZIP_LEVEL_ZSTD);
+    }
 
     return z->total - f->offset;
 }
 
+int zip_compressible(zip* z, const void* data, uint32_t size)
+{
+    uint8_t buffer[ZIP_SAMPLE_SIZE];
+    size_t isize = min32(size, sizeof(buffer));
+    // worth compressing if fastest level saves at least 1/8 of sample
+    size_t osize = isize - isize / 8;
+
+    int flags = tdefl_create_comp_flags_from_zip_params(MZ_BEST_SPEED, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
+    tdefl_init(&z->tdefl, flags);
+    return isize != 0 && tdefl_compress(&z->tdefl, data, &isize, buffer, &osize, TDEFL_FINISH) == TDEFL_STATUS_DONE;
+}
+
 void zip_write_file(zip* z, const void* data, uint32_t size)
 {
     z->current->size += size;
     crc32_update(&z->crc32, data, size);
 
-    if (z->current->compress)
+    if (z->current->method == ZIP_METHOD_DEFLATE)
     {
         const uint8_t* data8 = data;
         while (size != 0)
@@ -174,25 +515,29 @@ void zip_write_file(zip* z, const void* data, uint32_t size)
 
             if (osize != 0)
             {
-                sys_write(z->file, z->total, buffer, (uint32_t)osize);
+                zip_output(z, buffer, (uint32_t)osize);
                 z->current->compressed += osize;
-                z->total += osize;
             }
             data8 += isize;
             size -= (uint32_t)isize;
         }
     }
+#if defined(PKG2ZIP_ZSTD)
+    else if (z->current->method == ZIP_METHOD_ZSTD)
+    {
+        zip_zstd_compress(z, data, size, ZSTD_e_continue);
+    }
+#endif
     else
     {
-        sys_write(z->file, z->total, data, size);
+        zip_output(z, data, size);
         z->current->compressed += size;
-        z->total += size;
     }
 }
 
 void zip_end_file(zip* z)
 {
-    if (z->current->compress)
+    if (z->current->method == ZIP_METHOD_DEFLATE)
     {
         for (;;)
         {
@@ -204,9 +549,8 @@ void zip_end_file(zip* z)
 
             if (osize != 0)
             {
-                sys_write(z->file, z->total, buffer, (uint32_t)osize);
+                zip_output(z, buffer, (uint32_t)osize);
                 z->current->compressed += osize;
-                z->total += osize;
             }
             if (st == TDEFL_STATUS_DONE)
             {
@@ -214,13 +558,31 @@ void zip_end_file(zip* z)
             }
         }
     }
+#if defined(PKG2ZIP_ZSTD)
+    else if (z->current->method == ZIP_METHOD_ZSTD)
+    {
+        zip_zstd_compress(z, NULL, 0, ZSTD_e_end);
+    }
+#endif
 
     if (!z->crc32_set)
     {
         z->current->crc32 = crc32_done(&z->crc32);
     }
 
-    if (z->current->size != 0)
+    if (z->stream)
+    {
+        uint8_t descriptor[ZIP64_DATA_DESCRIPTOR_SIZE] = { 0x50, 0x4b, 0x07, 0x08 };
+        // crc-32
+        set32le(descriptor + 4, z->current->crc32);
+        // compressed size
+        set64le(descriptor + 8, z->current->compressed);
+        // uncompressed size
+        set64le(descriptor + 16, z->current->size);
+
+        zip_output(z, descriptor, sizeof(descriptor));
+    }
+    else if (z->current->compressed != 0)
     {
         uint8_t update[3 * sizeof(uint32_t)];
         // crc-32
@@ -230,7 +592,7 @@ void zip_end_file(zip* z)
         // uncompressed size
         set32le(update + 8, (uint32_t)min64(z->current->size, 0xffffffff));
 
-        sys_write(z->file, z->current->offset + ZIP_LOCAL_HEADER_CRC32_OFFSET, update, sizeof(update));
+        zip_write_at(z, z->current->offset + ZIP_LOCAL_HEADER_CRC32_OFFSET, update, sizeof(update));
     }
 
     z->current = NULL;
@@ -240,27 +602,28 @@ void zip_close(zip* z)
 {
     uint64_t central_dir_offset = z->total;
 
+    // central directory is built in memory from zip_file entries and written out with single write
+    size_t max_size = (size_t)z->count * (ZIP_GLOBAL_HEADER_SIZE + ZIP64_EXTRA_MAX_SIZE + ZIP_ALIGN_EXTRA_SIZE) + z->names_size
+        + ZIP64_EOC_DIR_SIZE + ZIP64_EOC_DIR_LOCATOR_SIZE + ZIP_EOC_DIR_SIZE;
+    uint8_t* buffer = sys_realloc(NULL, max_size);
+    uint8_t* ptr = buffer;
+
+    // entries in central directory on last disk
+    uint32_t disk = zip_disk(z, central_dir_offset);
+    uint32_t disk_count = 0;
+
     // central directory headers
     for (uint32_t i = 0; i < z->count; i++)
     {
         const zip_file* f = z->files + i;
 
-        uint8_t local[ZIP_LOCAL_HEADER_SIZE];
-        sys_read(z->file, f->offset, local, sizeof(local));
-
-        uint32_t filename_length = get16le(local + ZIP_LOCAL_HEADER_FILENAME_LENGTH_OFFSET);
-
-        uint8_t global[ZIP_GLOBAL_HEADER_SIZE + ZIP_MAX_FILENAME] = { 0x50, 0x4b, 0x01, 0x02 };
-        sys_read(z->file, f->offset + sizeof(local), global + ZIP_GLOBAL_HEADER_SIZE, filename_length);
-        int is_folder = global[ZIP_GLOBAL_HEADER_SIZE + filename_length - 1] == '/';
-
-        uint8_t extra[28];
         uint16_t extra_size = 0;
         uint64_t size = f->size;
         uint64_t compressed = f->compressed;
-        uint64_t offset = f->offset;
+        uint32_t start_disk = zip_disk(z, f->offset);
+        uint64_t offset = zip_disk_offset(z, f->offset);
         uint32_t attributes = ZIP_DOS_ATTRIBUTE_ARCHIVE;
-        if (is_folder)
+        if (f->folder)
         {
             attributes |= ZIP_DOS_ATTRIBUTE_DIRECTORY;
             if (offset > 0xffffffff)
@@ -283,20 +646,36 @@ void zip_close(zip* z)
                 extra_size += sizeof(uint64_t);
             }
         }
+        if (start_disk >= 0xffff)
+        {
+            extra_size += sizeof(uint32_t);
+        }
 
         if (extra_size)
         {
             extra_size += 2 * sizeof(uint16_t);
         }
+        // central directory has only alignment without padding
+        uint16_t align_size = f->align ? ZIP_ALIGN_EXTRA_SIZE : 0;
 
+        uint64_t record_offset = central_dir_offset + (ptr - buffer);
+        zip_volume_keep(z, record_offset, ZIP_GLOBAL_HEADER_SIZE + f->name_length + extra_size + align_size);
+        if (zip_disk(z, record_offset) != disk)
+        {
+            disk = zip_disk(z, record_offset);
+            disk_count = 0;
+        }
+        disk_count++;
+
+        uint8_t global[ZIP_GLOBAL_HEADER_SIZE] = { 0x50, 0x4b, 0x01, 0x02 };
         // version made by
-        set16le(global + 4, ZIP_VERSION);
+        set16le(global + 4, zip_version(f));
         // version needed to extract
-        set16le(global + 6, ZIP_VERSION);
+        set16le(global + 6, zip_version(f));
         // general purpose bit flag
-        set16le(global + 8, ZIP_UTF8_FLAG);
+        set16le(global + 8, f->flags);
         // compression method
-        set16le(global + 10, f->compress ? ZIP_METHOD_DEFLATE : ZIP_METHOD_STORE);
+        set16le(global + 10, f->method);
         // last mod file time
         set16le(global + 12, z->time);
         // last mod file date
@@ -308,51 +687,84 @@ void zip_close(zip* z)
         // uncompressed size
         set32le(global + 24, (uint32_t)min64(size, 0xffffffff));
         // file name length
-        set16le(global + 28, (uint16_t)filename_length);
+        set16le(global + 28, f->name_length);
         // extra field length
-        set16le(global + 30, extra_size);
+        set16le(global + 30, extra_size + align_size);
+        // disk number start
+        set16le(global + 34, (uint16_t)min32(start_disk, 0xffff));
         // external file attributes
         set32le(global + 38, attributes);
         // relative offset of local header 4 bytes
         set32le(global + 42, (uint32_t)min64(offset, 0xffffffff));
 
-        sys_write(z->file, z->total, global, ZIP_GLOBAL_HEADER_SIZE + filename_length);
-        z->total += ZIP_GLOBAL_HEADER_SIZE + filename_length;
+        memcpy(ptr, global, sizeof(global));
+        ptr += sizeof(global);
 
-        // zip64 Extended Information Extra Field
-        set16le(extra + 0, 1);
-        // size of this "extra" block
-        uint32_t extra_offset = 2 * sizeof(uint16_t);
-        set16le(extra + 2, (uint16_t)(extra_size - extra_offset));
-        if (compressed > 0xffffffff)
-        {
-            // size of compressed data
-            set64le(extra + extra_offset, compressed);
-            extra_offset += sizeof(uint64_t);
-        }
-        if (size > 0xffffffff)
-        {
-            // original uncompressed file size
-            set64le(extra + extra_offset, size);
-            extra_offset += sizeof(uint64_t);
-        }
-        if (offset > 0xffffffff)
+        memcpy(ptr, z->names + f->name, f->name_length);
+        ptr += f->name_length;
+
+        if (extra_size)
         {
-            // offset of local header record
-            set64le(extra + extra_offset, offset);
-            extra_offset += sizeof(uint64_t);
+            uint8_t* extra = ptr;
+
+            // zip64 Extended Information Extra Field
+            set16le(extra + 0, 1);
+            // size of this "extra" block
+            uint32_t extra_offset = 2 * sizeof(uint16_t);
+            set16le(extra + 2, (uint16_t)(extra_size - extra_offset));
+            if (compressed > 0xffffffff)
+            {
+                // size of compressed data
+                set64le(extra + extra_offset, compressed);
+                extra_offset += sizeof(uint64_t);
+            }
+            if (size > 0xffffffff)
+            {
+                // original uncompressed file size
+                set64le(extra + extra_offset, size);
+                extra_offset += sizeof(uint64_t);
+            }
+            if (offset > 0xffffffff)
+            {
+                // offset of local header record
+                set64le(extra + extra_offset, offset);
+                extra_offset += sizeof(uint64_t);
+            }
+            if (start_disk >= 0xffff)
+            {
+                // number of the disk on which this file starts
+                set32le(extra + extra_offset, start_disk);
+                extra_offset += sizeof(uint32_t);
+            }
+
+            ptr += extra_size;
         }
 
-        if (extra_size > 2 * sizeof(uint16_t))
+        if (align_size)
         {
-            sys_write(z->file, z->total, extra, extra_size);
-            z->total += extra_size;
+            // zipalign extra field
+            set16le(ptr + 0, ZIP_ALIGN_EXTRA_ID);
+            // size of this "extra" block
+            set16le(ptr + 2, align_size - 2 * sizeof(uint16_t));
+            // alignment
+            set16le(ptr + 4, f->align);
+
+            ptr += align_size;
         }
     }
 
-    uint64_t end_of_central_dir_offset = z->total;
+    uint64_t end_of_central_dir_offset = central_dir_offset + (ptr - buffer);
     uint64_t central_dir_size = end_of_central_dir_offset - central_dir_offset;
 
+    // all end of central directory records go to last disk
+    zip_volume_keep(z, end_of_central_dir_offset, ZIP64_EOC_DIR_SIZE + ZIP64_EOC_DIR_LOCATOR_SIZE + ZIP_EOC_DIR_SIZE);
+    uint32_t central_dir_disk = zip_disk(z, central_dir_offset);
+    uint32_t last_disk = zip_disk(z, end_of_central_dir_offset);
+    if (last_disk != disk)
+    {
+        disk_count = 0;
+    }
+
     // zip64 end of central directory record
     {
         uint8_t header[ZIP64_EOC_DIR_SIZE] = { 0x50, 0x4b, 0x06, 0x06 };
@@ -362,66 +774,121 @@ void zip_close(zip* z)
         set16le(header + 12, ZIP_VERSION);
         // version needed to extract
         set16le(header + 14, ZIP_VERSION);
+        // number of this disk
+        set32le(header + 16, last_disk);
+        // number of the disk with the start of the central directory
+        set32le(header + 20, central_dir_disk);
         // total number of entries in the central directory on this disk
-        set64le(header + 24, z->count);
+        set64le(header + 24, disk_count);
         // total number of entries in the central directory
         set64le(header + 32, z->count);
         // size of the central directory
         set64le(header + 40, central_dir_size);
         // offset of start of central directory with respect to the starting disk number
-        set64le(header + 48, central_dir_offset);
+        set64le(header + 48, zip_disk_offset(z, central_dir_offset));
 
-        sys_write(z->file, z->total, header, sizeof(header));
-        z->total += sizeof(header);
+        memcpy(ptr, header, sizeof(header));
+        ptr += sizeof(header);
     }
 
     // zip64 end of central directory locator
     {
         uint8_t header[ZIP64_EOC_DIR_LOCATOR_SIZE] = { 0x50, 0x4b, 0x06, 0x07 };
+        // number of the disk with the start of the zip64 end of central directory
+        set32le(header + 4, last_disk);
         // relative offset of the zip64 end of central directory record 8 bytes
-        set64le(header + 8, end_of_central_dir_offset);
+        set64le(header + 8, zip_disk_offset(z, end_of_central_dir_offset));
         // total number of disks
-        set32le(header + 16, 1);
+        set32le(header + 16, last_disk + 1);
 
-        sys_write(z->file, z->total, header, sizeof(header));
-        z->total += sizeof(header);
+        memcpy(ptr, header, sizeof(header));
+        ptr += sizeof(header);
     }
 
     // end of central directory record
     {
         uint8_t header[ZIP_EOC_DIR_SIZE] = { 0x50, 0x4b, 0x05, 0x06 };
+        // number of this disk
+        set16le(header + 4, (uint16_t)min32(last_disk, 0xffff));
+        // number of the disk with the start of the central directory
+        set16le(header + 6, (uint16_t)min32(central_dir_disk, 0xffff));
         // total number of entries in the central directory on this disk
-        set16le(header + 8, (uint16_t)min32(z->count, 0xffff));
+        set16le(header + 8, (uint16_t)min32(disk_count, 0xffff));
         // total number of entries in the central directory
         set16le(header + 10, (uint16_t)min32(z->count, 0xffff));
         // size of the central directory
         set32le(header + 12, (uint32_t)min64(central_dir_size, 0xffffffff));
         // offset of start of central directory with respect to the starting disk number
-        set32le(header + 16, (uint32_t)min64(central_dir_offset, 0xffffffff));
+        set32le(header + 16, (uint32_t)min64(zip_disk_offset(z, central_dir_offset), 0xffffffff));
 
-        sys_write(z->file, z->total, header, sizeof(header));
-        z->total += sizeof(header);
+        memcpy(ptr, header, sizeof(header));
+        ptr += sizeof(header);
     }
 
-    sys_close(z->file);
+    zip_output(z, buffer, (uint32_t)(ptr - buffer));
+
+    if (z->split != 0)
+    {
+        while (z->volume_open < z->volume_count)
+        {
+            sink_end(z->volumes[z->volume_open++]);
+        }
+
+        char name[sizeof(z->name) + 16];
+        zip_volume_name(z, z->volume_count - 1, name);
+        sys_rename(name, z->name);
+
+        sys_realloc(z->volume_start, 0);
+        sys_realloc(z->volumes, 0);
+    }
+    else
+    {
+        sink_end(z->sink);
+    }
 
+    sys_realloc(buffer, 0);
+    sys_realloc(z->names, 0);
     sys_realloc(z->files, 0);
+#if defined(PKG2ZIP_ZSTD)
+    if (z->zstd != NULL)
+    {
+        ZSTD_freeCCtx(z->zstd);
+        sys_realloc(z->zstd_buffer, 0);
+    }
+#endif
+}
+
+void zip_reserve(zip* z, uint64_t size)
+{
+    // sizes of volumes are not known in advance
+    if (z->split == 0)
+    {
+        sink_reserve(z->sink, z->total + size);
+    }
 }
 
 void zip_write_file_at(zip* z, uint64_t offset, const void* data, uint32_t size)
 {
-    if (z->current->compress)
+    if (z->current->method != ZIP_METHOD_STORE)
     {
         sys_error("ERROR: cannot write at specific offset for compressed files\n");
     }
+    if (z->stream)
+    {
+        sys_error("ERROR: cannot write at specific offset when streaming zip output\n");
+    }
 
-    sys_write(z->file, z->current->offset + offset, data, size);
+    zip_write_at(z, z->current->offset + offset, data, size);
     z->current->size += size;
     z->current->compressed += size;
 }
 
 void zip_set_offset(zip* z, uint64_t offset)
 {
+    if (z->stream)
+    {
+        sys_error("ERROR: cannot change offset when streaming zip output\n");
+    }
     z->total = z->current->offset + offset;
 }
 
@@ -1,37 +1,76 @@
 #pragma once
 
 #include "pkg2zip_sys.h"
+#include "pkg2zip_sink.h"
 #include "pkg2zip_crc32.h"
 #include "miniz_tdef.h"
 
 #include <stddef.h>
 #include <stdint.h>
 
+#if defined(PKG2ZIP_ZSTD)
+#include <zstd.h>
+#endif
+
 #define ZIP_MAX_FILENAME 1024
 
+// level flag to compress file with zstd instead of deflate, zstd levels are 1..22
+#define ZIP_LEVEL_ZSTD 0x200
+#define ZIP_ZSTD_DEFAULT_LEVEL 3
+#define ZIP_ZSTD_MAX_LEVEL 22
+
+// smallest volume size of split zip allowed by zip specification
+#define ZIP_MIN_SPLIT_SIZE (64 * 1024)
+
+// alignment padding must fit in extra field
+#define ZIP_MAX_ALIGN (32 * 1024)
+
 typedef struct zip_file zip_file;
 
 typedef struct {
-    sys_file file;
+    sink* sink;
+    int stream; // output is not seekable, sizes are written in data descriptors
     uint64_t total;
     uint32_t count;
     uint32_t max;
     uint16_t time;
     uint16_t date;
     tdefl_compressor tdefl;
+#if defined(PKG2ZIP_ZSTD)
+    ZSTD_CCtx* zstd;
+    uint8_t* zstd_buffer;
+    size_t zstd_buffer_size;
+#endif
     crc32_ctx crc32;
     int crc32_set;
     uint32_t allocated; // bytes
     zip_file* files;
     zip_file* current;
+    uint32_t names_size;
+    uint32_t names_allocated;
+    char* names;
+    // split zip is written to name.z01, name.z02, ... volumes, last one is renamed to name.zip
+    uint64_t split; // max size of volume, 0 when zip is not split
+    char name[ZIP_MAX_FILENAME + 8];
+    uint32_t volume_count;
+    uint32_t volume_open; // earlier volumes are finished and closed
+    uint64_t* volume_start; // offset in whole zip where volume starts
+    sink** volumes;
+    uint32_t align; // data of stored files starts at multiple of this, 0 when not aligned
 } zip;
 
-void zip_create(zip* z, const char* name);
+// split_size 0 writes single zip file, align is power of two up to ZIP_MAX_ALIGN or 0
+void zip_create(zip* z, const char* name, uint64_t split_size, uint32_t align);
 void zip_add_folder(zip* z, const char* name);
-uint64_t zip_begin_file(zip* z, const char* name, int compress);
+// level 0 stores file, 1..9 deflates it, ZIP_LEVEL_ZSTD|N compresses it with zstd level N
+uint64_t zip_begin_file(zip* z, const char* name, int level);
 void zip_write_file(zip* z, const void* data, uint32_t size);
 void zip_end_file(zip* z);
 void zip_close(zip* z);
+// checks if data compresses well enough, must be called before zip_begin_file
+int zip_compressible(zip* z, const void* data, uint32_t size);
+// preallocates space for size more bytes in zip file
+void zip_reserve(zip* z, uint64_t size);
 
 // hacky solution to be able to write cso header after the data is written
 void zip_write_file_at(zip* z, uint64_t offset, const void* data, uint32_t size);